@@ -1,38 +1,74 @@
 extern "C" {
 #include "read_xml.h"
+#include "read_xml_tokens.h"
+#include "read_xml_ent.h"
 }
+#include "read_xml_vocabulary.h"
+#include "read_xml_limits.h"
 #include <string.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
+#include <time.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
 
 #include <map>
+#include <set>
+#include <string>
 #include <vector>
 #include <algorithm>
 using namespace std;
 
 
-enum
+/*
+  Names the miner itself knows have fixed tokens.
+ */
+constexpr const char *known_names[] =
   {
-    token_hashtab_size = 5051
+    "<string>",
+    "<number>",
+    "ID",
+    "string",
+    "type",
+    "anyType",
   };
 
+constexpr auto known = make_xml_vocabulary(known_names);
 
-struct token_info_t
-{
-  const char *str;
-  unsigned next;
-  bool is_used;
-};
-
+enum known_token_t
+  {
+    t_STRING = known["<string>"],
+    t_NUMBER = known["<number>"],
+    t_ID = known["ID"],
+    t_string = known["string"],
+    t_type = known["type"],
+    t_anyType = known["anyType"],
+  };
 
+xml_token_t
+known_token(const char *str, unsigned len, unsigned hash)
+{
+  return known.find(str, len, hash);
+}
 
 
-xml_token_t
-token_hashtab[token_hashtab_size];
+struct xml_token_table_t token_table;
+pthread_once_t token_table_once = PTHREAD_ONCE_INIT;
 
-vector<token_info_t> tokens;
+/*
+  Tokens named in the generated code, marked by c_name().  Only the
+  generator marks them: xml_token_name() is also called by readers on
+  any thread, so it changes nothing.
+ */
+vector<bool> token_used;
 
 int global_is_verbose = true;
 
@@ -41,57 +77,153 @@ int extra_messages_allowed()
   return true;
 }
 
-xml_token_t
-xml_token_by_name(const char *str, unsigned opt_hash)
+bool
+intern_known_tokens()
 {
-  if (tokens.empty())
-    fill((token_hashtab + 0), (token_hashtab + token_hashtab_size), not_a_token);
-
-  if (opt_hash == 0)
+  for(unsigned t = 0; t < known.size(); ++t)
     {
-      for(const unsigned char *s = (const unsigned char *)str; *s; ++s)
-	opt_hash = 33*opt_hash + (*s);
+      const char *name = known.name(t);
+      if (intern_xml_token(&token_table, name, strlen(name),
+			   string_hash(name)) != t)
+	return false;
+      pin_xml_token(&token_table, t);
     }
-  
-  xml_token_t *loc = token_hashtab + (opt_hash % token_hashtab_size);
-  xml_token_t t;
-  
-  for(t = *loc; t != not_a_token; t = tokens[t].next)
+
+  /*
+    Readers keep these two across documents.
+   */
+  static const char *const kept[] = {"xmlns", ""};
+  for(const char *name : kept)
+    pin_xml_token(&token_table,
+		  intern_xml_token(&token_table, name, strlen(name),
+				   string_hash(name)));
+  return true;
+}
+
+/*
+  Known tokens may be taken from a snapshot made by "--save-tokens".
+  The names of the vocabulary are interned first, so the table gives
+  them the same tokens.
+ */
+void
+init_token_table()
+{
+  init_xml_token_table(&token_table);
+
+  const char *snapshot = getenv("XML_TOKENS");
+  if (snapshot)
     {
-      if (0 == strcmp(str, tokens[t].str))
-	return t;
+      int io = open(snapshot, O_RDONLY);
+      if (io == -1 || !load_xml_token_table(&token_table, io) ||
+	  !intern_known_tokens())
+	{
+	  fprintf(stderr, "%s \"%s\" %s\n",
+		  "token snapshot", snapshot, "not loaded");
+	  done_xml_token_table(&token_table);
+	}
+      if (io != -1)
+	close(io);
     }
 
-  token_info_t token1;
-  token1.str = strdup(str);
-  token1.next = *loc;
-  *loc = tokens.size();
-  token1.is_used = false;
-  tokens.push_back(token1);
-  return *loc;
+  intern_known_tokens();
+}
+
+xml_token_t
+xml_token_by_name(const char *str, unsigned opt_hash)
+{
+  pthread_once(&token_table_once, init_token_table);
+  if (opt_hash == 0)
+    opt_hash = string_hash(str);
+
+  return intern_xml_token(&token_table, str, strlen(str), opt_hash);
+}
+
+
+/*
+  Names stay on the reader stack and in its bindings across nodes, so
+  they are pinned: a token limit then reclaims values only.
+ */
+xml_token_t
+name_token(const char *str, unsigned opt_hash)
+{
+  pthread_once(&token_table_once, init_token_table);
+  if (opt_hash == 0)
+    opt_hash = string_hash(str);
+
+  return intern_xml_name(&token_table, str, strlen(str), opt_hash);
 }
 
 
 const char *
 xml_token_name(xml_token_t t)
 {
-  if (t < tokens.size())
-    {
-      token_info_t &info = tokens[t];
-      info.is_used = true;
-      return info.str;
-    }
+  pthread_once(&token_table_once, init_token_table);
+  struct xml_token_name_t name;
+  if (xml_token_table_name(&token_table, t, &name))
+    return name.str;
   return  "<unknown>";
 }
 
 
 
-xml_token_t t_STRING = xml_token_by_name("<string>", 0);
-xml_token_t t_NUMBER = xml_token_by_name("<number>", 0);
-xml_token_t t_ID = xml_token_by_name("ID", 0);
-xml_token_t t_string = xml_token_by_name("string", 0);
-xml_token_t t_type = xml_token_by_name("type", 0);
-xml_token_t t_anyType = xml_token_by_name("anyType", 0);
+/*
+  Token name as a C identifier for the generated code.  Letters and
+  digits are kept, any other byte (the underscore too) becomes "_" and
+  two hex digits, so different names never give the same identifier:
+  "a-b" is "a_2db" and "a_b" is "a_5fb".  The token is marked used, so
+  the vocabulary of the generated code has it.
+ */
+string
+c_name(xml_token_t t)
+{
+  static const char hex[] = "0123456789abcdef";
+  string name;
+  if (token_used.size() <= t)
+    token_used.resize(t + 1);
+  token_used[t] = true;
+  for(const char *c = xml_token_name(t); *c; ++c)
+    {
+      unsigned char byte = *c;
+      if (isascii(byte) && isalnum(byte))
+	name += *c;
+      else
+	{
+	  name += '_';
+	  name += hex[byte >> 4];
+	  name += hex[byte & 15];
+	}
+    }
+  return name;
+}
+
+
+/*
+  Token name as the body of a C string literal: quotes and backslashes
+  are escaped, bytes other than printable ASCII are given in octal.
+ */
+string
+c_string(xml_token_t t)
+{
+  string str;
+  for(const char *c = xml_token_name(t); *c; ++c)
+    {
+      unsigned char byte = *c;
+      if (byte == '"' || byte == '\\')
+	{
+	  str += '\\';
+	  str += *c;
+	}
+      else if (byte >= ' ' && byte <= '~')
+	str += *c;
+      else
+	{
+	  char octal[8];
+	  snprintf(octal, sizeof(octal), "\\%03o", byte);
+	  str += octal;
+	}
+    }
+  return str;
+}
 
 
 
@@ -176,6 +308,914 @@ add_mined_item(xml_token_t tag_token,
   info.is_item = true;  
 }
 
+/*
+  L1 data cache read misses of this thread, counted by the kernel where
+  it can.  The counter is -1 when they are not counted.
+ */
+int
+open_l1d_misses()
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.type = PERF_TYPE_HW_CACHE;
+  attr.size = sizeof(attr);
+  attr.config = PERF_COUNT_HW_CACHE_L1D |
+    PERF_COUNT_HW_CACHE_OP_READ << 8 |
+    PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#else
+  return -1;
+#endif
+}
+
+unsigned long long
+read_l1d_misses(int counter)
+{
+  unsigned long long misses = 0;
+  if (counter == -1 || read(counter, &misses, sizeof(misses)) != sizeof(misses))
+    return 0;
+  return misses;
+}
+
+double
+seconds()
+{
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec + now.tv_nsec*1e-9;
+}
+
+
+/*
+  Reads a whole file for the modes which parse from memory.
+ */
+bool
+read_file(const char *fname, string &data)
+{
+  int io = open(fname, O_RDONLY);
+  if (io == -1)
+    {
+      fprintf(stderr, "%s \"%s\" %s\n",
+	      "file", (fname), "not found");
+      return false;
+    }
+  char buf[65536];
+  ssize_t n;
+  while ((n = read(io, buf, sizeof(buf))) > 0)
+    data.append(buf, n);
+  close(io);
+  return true;
+}
+
+
+/*
+  "--bench READERS [ROUNDS]": parses the listed files ROUNDS times with
+  READERS readers taking turns node by node, as a server with many
+  connections does, and prints the speed and the L1 misses per byte.
+  The files are read in advance, only the parsing is measured.  The
+  same files are then parsed by the readers of bench_limits(), and
+  their names are used to time the token hash, see bench_tokens().
+ */
+typedef basic_read_xml<xml_default_limits_t, true> bench_reader_t;
+
+/*
+  A plain C reader, as a C program sets it up.
+ */
+struct c_fixed_reader_t : read_xml_t
+{
+  void
+  init_mem(const char *data, size_t len, const char *name)
+  {
+    init_read_xml_mem(this, data, len, name);
+  }
+};
+
+struct small_limits_t : xml_default_limits_t
+{
+  static constexpr unsigned attrs_size = 2;
+  static constexpr unsigned bound_size = 2;
+  static constexpr unsigned stack_size = 4;
+  static constexpr unsigned text_size = 64;
+  static constexpr unsigned io_buf_size = 0;
+};
+
+/*
+  The readers take turns node by node on the documents and the errors
+  they found are returned.
+ */
+template<class Reader>
+unsigned
+bench_parse(const vector<pair<string, string> > &docs, unsigned readers,
+	    unsigned rounds)
+{
+  vector<Reader *> X(readers);
+  vector<bool> busy(readers);
+  size_t next = 0, total = docs.size()*rounds;
+  unsigned errors = 0;
+  unsigned active = 0;
+
+  for(unsigned i = 0; i < readers; ++i)
+    X[i] = new Reader;
+
+  do
+    for(unsigned i = 0; i < readers; ++i)
+      {
+	if (busy[i] && !X[i]->eof)
+	  {
+	    bump_xml_node(X[i]);
+	    continue;
+	  }
+	if (busy[i])
+	  {
+	    errors += X[i]->errors;
+	    done_read_xml(X[i]);
+	    busy[i] = false;
+	    --active;
+	  }
+	if (next < total)
+	  {
+	    const pair<string, string> &doc = docs[next++ % docs.size()];
+	    X[i]->init_mem(doc.second.data(), doc.second.size(),
+			   doc.first.c_str());
+	    set_read_xml_known_tokens(X[i], known_token);
+	    set_read_xml_name_tokens(X[i], name_token);
+	    busy[i] = true;
+	    ++active;
+	  }
+      }
+  while (active);
+
+  for(unsigned i = 0; i < readers; ++i)
+    delete X[i];
+  return errors;
+}
+
+/*
+  The limits part of "--bench": the same files with a plain C reader,
+  with the fixed default limits of the template, with growable default
+  limits, and with small limits grown on demand.  The default limits
+  use the storage of the C reader, other ones add their own.
+ */
+template<class Reader>
+void
+bench_limits(const char *name, const vector<pair<string, string> > &docs,
+	     unsigned readers, unsigned rounds, unsigned long long bytes)
+{
+  double start = seconds();
+  bench_parse<Reader>(docs, readers, rounds);
+  double elapsed = seconds() - start;
+  fprintf(stderr, "%s_sizeof = %u\n", name, (unsigned)sizeof(Reader));
+  fprintf(stderr, "%s_mb_per_s = %.1f\n", name, bytes/elapsed/1e6);
+}
+
+/*
+  The token part of "--bench" times the hash and the token table on the
+  tag and attribute names of the files: each name, as often as it
+  occurs, is hashed and then looked up in a table of the distinct ones.
+  The hash is the one chosen by "configure --with-xml-hash", so the
+  choices are compared by running the same files with each build.
+ */
+void
+bench_tokens(const vector<pair<string, string> > &docs, unsigned rounds)
+{
+  vector<string> names;
+  for(size_t i = 0; i < docs.size(); ++i)
+    {
+      bench_reader_t X[1];
+      X->init_mem(docs[i].second.data(), docs[i].second.size(),
+		  docs[i].first.c_str());
+      while (!X->eof)
+	if (bump_xml_node(X) == xml_node_open)
+	  for(unsigned a = 0; a < X->attrs_size; ++a)
+	    names.push_back(X->text + X->attrs[a].id_index);
+      done_read_xml(X);
+    }
+  if (names.empty())
+    return;
+
+  volatile unsigned sink = 0;
+  double start = seconds();
+  for(unsigned r = 0; r < rounds; ++r)
+    for(size_t i = 0; i < names.size(); ++i)
+      sink += xml_hash(names[i].data(), names[i].size());
+  double hashing = seconds() - start;
+
+  struct xml_token_table_t table;
+  init_xml_token_table(&table);
+  for(size_t i = 0; i < names.size(); ++i)
+    intern_xml_token(&table, names[i].data(), names[i].size(),
+		     xml_hash(names[i].data(), names[i].size()));
+
+  start = seconds();
+  for(unsigned r = 0; r < rounds; ++r)
+    for(size_t i = 0; i < names.size(); ++i)
+      sink += find_xml_token(&table, names[i].data(), names[i].size(),
+			     xml_hash(names[i].data(), names[i].size()));
+  double lookups = seconds() - start;
+
+  struct xml_token_stats_t stats;
+  xml_token_table_stats(&table, &stats);
+  done_xml_token_table(&table);
+
+  double count = (double)names.size()*rounds;
+  fprintf(stderr, "hash = %s\n",
+	  XML_HASH == XML_HASH_FNV1A ? "fnv1a" :
+	  XML_HASH == XML_HASH_WORD ? "word" : "33");
+  fprintf(stderr, "names = %u\n", (unsigned)names.size());
+  fprintf(stderr, "distinct_names = %u\n", stats.tokens);
+  fprintf(stderr, "hash_ns_per_name = %.1f\n", hashing/count*1e9);
+  fprintf(stderr, "lookup_ns_per_name = %.1f\n", lookups/count*1e9);
+  fprintf(stderr, "names_hash_avg_case = %u.%02u\n",
+	  stats.avg_probes_x100/100, stats.avg_probes_x100%100);
+  fprintf(stderr, "names_hash_worst_case = %u\n", stats.worst_probes);
+}
+
+int
+bench(unsigned readers, unsigned rounds)
+{
+  vector<pair<string, string> > docs;
+  char fname[256];
+  while (fgets(fname, sizeof(fname), stdin))
+    {
+      fname[strcspn(fname, "\n")] = 0;
+      string data;
+      if (!read_file(fname, data))
+	return 1;
+      docs.push_back(make_pair(string(fname), data));
+    }
+  if (docs.empty() || readers == 0 || rounds == 0)
+    return 1;
+
+  unsigned long long bytes = 0;
+  for(size_t i = 0; i < docs.size(); ++i)
+    bytes += docs[i].second.size();
+  bytes *= rounds;
+
+  int counter = open_l1d_misses();
+  double start = seconds();
+  unsigned long long misses = read_l1d_misses(counter);
+
+  unsigned errors = bench_parse<bench_reader_t>(docs, readers, rounds);
+
+  misses = read_l1d_misses(counter) - misses;
+  double elapsed = seconds() - start;
+
+  /*
+    The token width is chosen by "configure --with-xml-token-bits", its
+    cache cost shows in the node sizes and the speed of the same files
+    with each build.  Every name and value of the files is interned.
+   */
+  struct xml_token_stats_t stats;
+  xml_token_table_stats(&token_table, &stats);
+
+  fprintf(stderr, "readers = %u\n", readers);
+  fprintf(stderr, "token_bits = %u\n", (unsigned)XML_TOKEN_BITS);
+  fprintf(stderr, "tokens = %u\n", stats.tokens);
+  fprintf(stderr, "sizeof(read_xml_t) = %u\n", (unsigned)sizeof(read_xml_t));
+  fprintf(stderr, "sizeof(xml_attr_t) = %u\n", (unsigned)sizeof(xml_attr_t));
+  fprintf(stderr, "sizeof(xml_stack_node_t) = %u\n",
+	  (unsigned)sizeof(xml_stack_node_t));
+  fprintf(stderr, "bytes = %llu\n", bytes);
+  fprintf(stderr, "finished with %u errors\n", errors);
+  fprintf(stderr, "mb_per_s = %.1f\n", bytes/elapsed/1e6);
+  if (counter != -1)
+    {
+      fprintf(stderr, "l1d_misses_per_byte = %.4f\n", (double)misses/bytes);
+      close(counter);
+    }
+  else
+    fprintf(stderr, "l1d_misses_per_byte = %s\n", "not counted here");
+
+  bench_limits<c_fixed_reader_t>("c_fixed", docs, readers, rounds, bytes);
+  bench_limits<basic_read_xml<> >("fixed", docs, readers, rounds, bytes);
+  bench_limits<bench_reader_t>("growable", docs, readers, rounds, bytes);
+  bench_limits<basic_read_xml<small_limits_t, true> >("small_growable",
+						      docs, readers, rounds,
+						      bytes);
+  bench_tokens(docs, rounds);
+  return errors != 0;
+}
+
+
+/*
+  "--compare": parses each listed file from memory, from a mapping, from
+  the descriptor and pushed in fragments, and compares the node streams
+  with the one read through a 1 byte buffer.  There every byte is a
+  window of its own, so the lexer takes it as the old per byte reader
+  did, and the span scanning of the other inputs must give the same
+  nodes, texts, attributes, locations and error counts.  The fragments
+  are mostly of 1 to 8 bytes and sometimes up to 512, from a generator
+  seeded by the file size, so tags, literals, escapes and comments are
+  cut at every kind of place and a difference is repeatable.  CDATA
+  sections come by windows, so their pieces are joined and their
+  locations are not compared.  The texts of each file are also checked
+  in pieces, see chunk_limits_t.
+ */
+typedef basic_read_xml<> compare_reader_t;
+
+#ifdef XML_NO_LOCATIONS
+const bool no_locations = true;
+#else
+const bool no_locations = false;
+#endif
+
+enum compare_input_t
+  {
+    compare_by_byte,
+    compare_fd,
+    compare_mmap,
+    compare_mem,
+    compare_push,
+    compare_inputs
+  };
+
+const char *const compare_input_names[] =
+  {
+    "byte by byte",
+    "fd",
+    "mmap",
+    "mem",
+    "push",
+  };
+
+/*
+  A node as compared: its type, depth, location and error count, then
+  its text, attributes or tag name.  @var{text} is the text of a text
+  node, joined from its pieces for a chunked one.
+ */
+string
+node_string(read_xml_t *X, xml_node_type_t t, const string &text)
+{
+  /*
+    Without locations the column is a cursor in the window, so it
+    differs with the window size and is not compared.
+   */
+  char head[64];
+  if (t == xml_node_cdata || no_locations)
+    snprintf(head, sizeof(head), "%d %u %u ",
+	     t, X->stack_size, X->errors);
+  else
+    snprintf(head, sizeof(head), "%d %u %u:%u %u ",
+	     t, X->stack_size, X->loc.line_no, X->loc.col_no, X->errors);
+  string node = head;
+
+  if (t == xml_node_text || t == xml_node_cdata)
+    node += text;
+  else if (t == xml_node_open)
+    for(unsigned a = 0; a < X->attrs_size; ++a)
+      {
+	node += xml_token_name(X->attrs[a].namesp_token);
+	node += ':';
+	node += xml_token_name(X->attrs[a].id_token);
+	if (a)
+	  {
+	    node += '=';
+	    node += xml_attr_value(X, X->attrs + a).str;
+	  }
+	node += ' ';
+      }
+  else if (t == xml_node_close)
+    node += xml_token_name(current_xml_tag_token(X));
+  return node;
+}
+
+/*
+  Reads the nodes of an initialized reader to the end.  A push reader
+  is fed @var{data} in fragments of random size.  The pieces of a
+  CDATA section, and of a chunked text, are joined into one node.
+ */
+void
+collect_nodes(read_xml_t *X, const string &data, vector<string> &nodes)
+{
+  size_t fed = 0;
+  unsigned seed = data.size();
+  bool in_cdata = false;
+  string chunks;
+
+  set_read_xml_known_tokens(X, known_token);
+  set_read_xml_name_tokens(X, name_token);
+  while (!X->eof)
+    {
+      xml_node_type_t t = bump_xml_node(X);
+      if (t == xml_node_need_more)
+	{
+	  unsigned r = rand_r(&seed);
+	  size_t len = min(data.size() - fed,
+			   (size_t)(r % 4 ? 1 + r/4 % 8 : 1 + r/4 % 512));
+	  xml_feed(X, data.data() + fed, len);
+	  fed += len;
+	  continue;
+	}
+      if (t == xml_node_cdata && in_cdata)
+	{
+	  nodes.back().append(X->view.str, X->view.len);
+	  continue;
+	}
+      in_cdata = t == xml_node_cdata;
+
+      if (t == xml_node_text_chunk)
+	{
+	  chunks += X->text;
+	  if (X->last_chunk)
+	    {
+	      nodes.push_back(node_string(X, xml_node_text, chunks));
+	      chunks.clear();
+	    }
+	}
+      else if (t == xml_node_cdata)
+	nodes.push_back(node_string(X, t, string(X->view.str, X->view.len)));
+      else
+	nodes.push_back(node_string(X, t, t == xml_node_text ? X->text : ""));
+    }
+
+  char tail[32];
+  snprintf(tail, sizeof(tail), "%u", X->errors);
+  nodes.push_back(tail);
+}
+
+bool
+read_nodes(compare_input_t input, const char *fname, const string &data,
+	   vector<string> &nodes)
+{
+  int io = open(fname, O_RDONLY);
+  if (io == -1)
+    {
+      fprintf(stderr, "%s \"%s\" %s\n",
+	      "file", (fname), "not found");
+      return false;
+    }
+
+  compare_reader_t X[1];
+  unsigned char byte[1];
+  vector<unsigned char> carry;
+  switch(input)
+    {
+    case compare_by_byte:
+      X->init(io, fname);
+      set_read_xml_buffer(X, byte, sizeof(byte));
+      break;
+    case compare_mmap:
+      X->init_mmap(io, fname);
+      break;
+    case compare_mem:
+      X->init_mem(data.data(), data.size(), fname);
+      break;
+    case compare_push:
+      X->init_push(fname);
+      carry.resize(data.size() + 1);
+      set_read_xml_buffer(X, carry.data(), carry.size());
+      break;
+    default:
+      X->init(io, fname);
+      break;
+    }
+  collect_nodes(X, data, nodes);
+
+  done_read_xml(X);
+  close(io);
+  return true;
+}
+
+/*
+  The chunk pass of "--compare": a reader with the smallest text buffer
+  delivers long texts in pieces, which joined must be the texts of a
+  reader whose buffer grows.  Both grow their other buffers, so long
+  names and values are no errors.  With the smallest buffer most texts
+  are cut, within words, runs of spaces and escapes.
+ */
+struct chunk_limits_t : xml_default_limits_t
+{
+  static constexpr unsigned text_size = 16;
+};
+
+template<class Reader>
+void
+read_grown_nodes(const char *fname, const string &data, bool chunks,
+		 vector<string> &nodes)
+{
+  Reader X[1];
+  X->init_mem(data.data(), data.size(), fname);
+  set_read_xml_text_chunks(X, chunks);
+  collect_nodes(X, data, nodes);
+  done_read_xml(X);
+}
+
+int
+compare()
+{
+  unsigned files = 0, differ = 0;
+  char fname[256];
+  while (fgets(fname, sizeof(fname), stdin))
+    {
+      fname[strcspn(fname, "\n")] = 0;
+      string data;
+      vector<string> nodes[compare_inputs];
+      if (!read_file(fname, data))
+	return 1;
+      for(unsigned i = 0; i < compare_inputs; ++i)
+	if (!read_nodes(compare_input_t(i), fname, data, nodes[i]))
+	  return 1;
+
+      bool same = true;
+      for(unsigned i = compare_by_byte + 1; same && i < compare_inputs; ++i)
+	{
+	  vector<string> &ref = nodes[compare_by_byte];
+	  size_t size = min(ref.size(), nodes[i].size());
+	  size_t at = mismatch(ref.begin(), ref.begin() + size,
+			       nodes[i].begin()).first - ref.begin();
+	  if (at < size || ref.size() != nodes[i].size())
+	    {
+	      fprintf(stderr, "%s \"%s\" %s %s %u\n",
+		      "file", (fname), compare_input_names[i],
+		      "differs from byte by byte at node", (unsigned)at);
+	      same = false;
+	    }
+	}
+
+      vector<string> grown, chunked;
+      read_grown_nodes<basic_read_xml<xml_default_limits_t, true> >
+	(fname, data, false, grown);
+      read_grown_nodes<basic_read_xml<chunk_limits_t, true> >
+	(fname, data, true, chunked);
+      size_t size = min(grown.size(), chunked.size());
+      size_t at = mismatch(grown.begin(), grown.begin() + size,
+			   chunked.begin()).first - grown.begin();
+      if (at < size || grown.size() != chunked.size())
+	{
+	  fprintf(stderr, "%s \"%s\" %s %u\n",
+		  "file", (fname), "chunks differ from grown text at node",
+		  (unsigned)at);
+	  same = false;
+	}
+      differ += !same;
+      ++files;
+    }
+
+  fprintf(stderr, "compared %u files\n", files);
+  fprintf(stderr, "%u files differ\n", differ);
+  return differ != 0;
+}
+
+
+/*
+  "--self-test": checks of the reader which need no corpus.  The failed
+  ones are printed, and the mode exits nonzero if there are any.
+ */
+unsigned self_test_failures = 0;
+
+void
+self_check(bool ok, const char *what)
+{
+  if (!ok)
+    {
+      fprintf(stderr, "%s: %s\n", "self-test failed", what);
+      ++self_test_failures;
+    }
+}
+
+/*
+  Lazy locations keep byte offsets as 32 bit column numbers, so they are
+  kept for a document just under 4GB and refused from 4GB on.  The
+  documents are address space reserved for the lengths, they are not
+  read.
+ */
+void
+test_lazy_location_limit()
+{
+#ifndef XML_NO_LOCATIONS
+  size_t limit = (unsigned)max_col_no;
+  if (sizeof(size_t) <= sizeof(unsigned))
+    return;
+
+  void *data = mmap(0, limit + 1, PROT_READ,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (data == MAP_FAILED)
+    {
+      fprintf(stderr, "%s\n", "self-test: no address space for 4GB documents");
+      return;
+    }
+  const char *doc = (const char *)data;
+
+  basic_read_xml<> X[1];
+  X->init_mem(doc, limit - 1, "below");
+  self_check(set_read_xml_lazy_locations(X),
+	     "lazy locations refused under 4GB");
+  reset_read_xml_mem(X, doc, limit - 1, "below");
+  self_check(X->lazy_loc, "lazy locations dropped by reset under 4GB");
+  reset_read_xml_mem(X, doc, limit, "at");
+  self_check(!X->lazy_loc, "lazy locations kept by reset at 4GB");
+  done_read_xml(X);
+
+  X->init_mem(doc, limit, "at");
+  self_check(!set_read_xml_lazy_locations(X), "lazy locations set at 4GB");
+  done_read_xml(X);
+
+  X->init_mem(doc, limit + 1, "over");
+  self_check(!set_read_xml_lazy_locations(X), "lazy locations set over 4GB");
+  done_read_xml(X);
+
+  munmap(data, limit + 1);
+#endif
+}
+
+/*
+  With a capped token table value tokens are reclaimed while a document
+  is parsed, but the names of open tags are pinned by the name interner
+  and keep matching their closing tags.  The document has many more
+  distinct values than the cap, and a generation is started after every
+  node, so unpinned names would be reclaimed and their IDs reused.
+ */
+void
+test_token_limit()
+{
+  static const unsigned limit = 64, depth = 16, values = 1000;
+  string doc;
+  for(unsigned i = 0; i < depth; ++i)
+    doc += "<open" + to_string(i) + " key=\"" + to_string(i) + "\">";
+  for(unsigned i = 0; i < values; ++i)
+    doc += "<v>value" + to_string(i) + "</v>";
+  for(unsigned i = depth; i-- > 0;)
+    doc += "</open" + to_string(i) + ">";
+
+  /*
+    The table is set up on first use, which would drop the limit.
+   */
+  pthread_once(&token_table_once, init_token_table);
+  set_xml_token_limit(&token_table, limit);
+
+  basic_read_xml<> X[1];
+  X->init_mem(doc.data(), doc.size(), "token limit");
+  set_read_xml_known_tokens(X, known_token);
+  set_read_xml_name_tokens(X, name_token);
+
+  vector<string> open;
+  bool kept = true;
+  while (!X->eof)
+    {
+      if (bump_xml_node(X) == xml_node_open)
+	{
+	  open.resize(X->stack_size);
+	  open.back() = xml_token_name(X->attrs[0].id_token);
+	}
+      if (X->stack_size &&
+	  open[X->stack_size - 1] != xml_token_name(current_xml_tag_token(X)))
+	kept = false;
+      next_xml_token_generation(&token_table);
+    }
+
+  struct xml_token_stats_t stats;
+  xml_token_table_stats(&token_table, &stats);
+  self_check(kept, "open tag tokens reclaimed under a token limit");
+  self_check(X->errors == 0, "tags mismatched under a token limit");
+  self_check(stats.values <= limit, "token limit passed");
+  done_read_xml(X);
+
+  set_xml_token_limit(&token_table, 0);
+}
+
+/*
+  A stream which does not fit a reader is refused by unpark_read_xml()
+  before the reader is changed: the parked stream is growable and
+  nested deeper than the small reader, which would grow for it, but its
+  cut node does not fit the small reader, which has no I/O buffer.
+ */
+void
+test_unpark_refused()
+{
+  static const char head[] = "<a><b><c><d><e><f><g", tail[] = "/></f></e>"
+    "</d></c></b></a>";
+
+  bench_reader_t X[1];
+  X->init_push("unpark");
+  xml_feed(X, head, strlen(head));
+  while (bump_xml_node(X) != xml_node_need_more)
+    ;
+  xml_parked_t *P = park_read_xml(X);
+  self_check(P != 0, "push stream not parked");
+  done_read_xml(X);
+  if (P == 0)
+    return;
+
+  basic_read_xml<small_limits_t> Y[1];
+  Y->init_mem("", 0, "small");
+  self_check(!unpark_read_xml(Y, P), "stream unparked over the I/O buffer");
+  self_check(!Y->grow && Y->grown == 0 &&
+	     Y->limits.stack_size == small_limits_t::stack_size,
+	     "reader changed by a refused unpark");
+  done_read_xml(Y);
+
+  basic_read_xml<> Z[1];
+  Z->init_mem("", 0, "default");
+  self_check(unpark_read_xml(Z, P), "stream not unparked");
+  xml_feed(Z, tail, strlen(tail));
+  xml_feed(Z, "", 0);
+  while (!Z->eof)
+    bump_xml_node(Z);
+  self_check(Z->errors == 0, "unparked stream not finished");
+  done_read_xml(Z);
+}
+
+/*
+  Interning a view leaves the collected text in place, so the views
+  into it stay valid: the escaped value is collected into the text, the
+  long value is a view of the input longer than the rest of the text.
+ */
+void
+test_view_interning()
+{
+  string doc = "<t a=\"x&amp;y\" b=\"" + string(100, 'v') + "\"/>";
+
+  basic_read_xml<small_limits_t, true> X[1];
+  X->init_mem(doc.data(), doc.size(), "views");
+  set_read_xml_views(X, true);
+  set_read_xml_intern_values(X, false);
+  if (bump_xml_node(X) != xml_node_open || X->attrs_size != 3)
+    {
+      self_check(false, "no tag with two attributes");
+      done_read_xml(X);
+      return;
+    }
+
+  xml_view_t a = xml_attr_view(X, &X->attrs[1]);
+  const char *text = X->text;
+  intern_xml_attr_value(X, &X->attrs[2]);
+  self_check(X->text == text && string(a.str, a.len) == "x&y",
+	     "view moved by interning a view");
+  done_read_xml(X);
+}
+
+/*
+  The named references: the entities of the HTML 4 DTDs and "apos",
+  with "nbsp" kept as a usual space.
+ */
+const struct
+{
+  const char *name;
+  int code;
+} html_entities[] =
+  {
+    {"AElig", 198}, {"Aacute", 193}, {"Acirc", 194}, {"Agrave", 192},
+    {"Alpha", 913}, {"Aring", 197}, {"Atilde", 195}, {"Auml", 196},
+    {"Beta", 914}, {"Ccedil", 199}, {"Chi", 935}, {"Dagger", 8225},
+    {"Delta", 916}, {"ETH", 208}, {"Eacute", 201}, {"Ecirc", 202},
+    {"Egrave", 200}, {"Epsilon", 917}, {"Eta", 919}, {"Euml", 203},
+    {"Gamma", 915}, {"Iacute", 205}, {"Icirc", 206}, {"Igrave", 204},
+    {"Iota", 921}, {"Iuml", 207}, {"Kappa", 922}, {"Lambda", 923},
+    {"Mu", 924}, {"Ntilde", 209}, {"Nu", 925}, {"OElig", 338},
+    {"Oacute", 211}, {"Ocirc", 212}, {"Ograve", 210}, {"Omega", 937},
+    {"Omicron", 927}, {"Oslash", 216}, {"Otilde", 213}, {"Ouml", 214},
+    {"Phi", 934}, {"Pi", 928}, {"Prime", 8243}, {"Psi", 936}, {"Rho", 929},
+    {"Scaron", 352}, {"Sigma", 931}, {"THORN", 222}, {"Tau", 932},
+    {"Theta", 920}, {"Uacute", 218}, {"Ucirc", 219}, {"Ugrave", 217},
+    {"Upsilon", 933}, {"Uuml", 220}, {"Xi", 926}, {"Yacute", 221},
+    {"Yuml", 376}, {"Zeta", 918}, {"aacute", 225}, {"acirc", 226},
+    {"acute", 180}, {"aelig", 230}, {"agrave", 224}, {"alefsym", 8501},
+    {"alpha", 945}, {"amp", 38}, {"and", 8743}, {"ang", 8736}, {"apos", 39},
+    {"aring", 229}, {"asymp", 8776}, {"atilde", 227}, {"auml", 228},
+    {"bdquo", 8222}, {"beta", 946}, {"brvbar", 166}, {"bull", 8226},
+    {"cap", 8745}, {"ccedil", 231}, {"cedil", 184}, {"cent", 162},
+    {"chi", 967}, {"circ", 710}, {"clubs", 9827}, {"cong", 8773},
+    {"copy", 169}, {"crarr", 8629}, {"cup", 8746}, {"curren", 164},
+    {"dArr", 8659}, {"dagger", 8224}, {"darr", 8595}, {"deg", 176},
+    {"delta", 948}, {"diams", 9830}, {"divide", 247}, {"eacute", 233},
+    {"ecirc", 234}, {"egrave", 232}, {"empty", 8709}, {"emsp", 8195},
+    {"ensp", 8194}, {"epsilon", 949}, {"equiv", 8801}, {"eta", 951},
+    {"eth", 240}, {"euml", 235}, {"euro", 8364}, {"exist", 8707},
+    {"fnof", 402}, {"forall", 8704}, {"frac12", 189}, {"frac14", 188},
+    {"frac34", 190}, {"frasl", 8260}, {"gamma", 947}, {"ge", 8805},
+    {"gt", 62}, {"hArr", 8660}, {"harr", 8596}, {"hearts", 9829},
+    {"hellip", 8230}, {"iacute", 237}, {"icirc", 238}, {"iexcl", 161},
+    {"igrave", 236}, {"image", 8465}, {"infin", 8734}, {"int", 8747},
+    {"iota", 953}, {"iquest", 191}, {"isin", 8712}, {"iuml", 239},
+    {"kappa", 954}, {"lArr", 8656}, {"lambda", 955}, {"lang", 9001},
+    {"laquo", 171}, {"larr", 8592}, {"lceil", 8968}, {"ldquo", 8220},
+    {"le", 8804}, {"lfloor", 8970}, {"lowast", 8727}, {"loz", 9674},
+    {"lrm", 8206}, {"lsaquo", 8249}, {"lsquo", 8216}, {"lt", 60},
+    {"macr", 175}, {"mdash", 8212}, {"micro", 181}, {"middot", 183},
+    {"minus", 8722}, {"mu", 956}, {"nabla", 8711}, {"nbsp", 32},
+    {"ndash", 8211}, {"ne", 8800}, {"ni", 8715}, {"not", 172},
+    {"notin", 8713}, {"nsub", 8836}, {"ntilde", 241}, {"nu", 957},
+    {"oacute", 243}, {"ocirc", 244}, {"oelig", 339}, {"ograve", 242},
+    {"oline", 8254}, {"omega", 969}, {"omicron", 959}, {"oplus", 8853},
+    {"or", 8744}, {"ordf", 170}, {"ordm", 186}, {"oslash", 248},
+    {"otilde", 245}, {"otimes", 8855}, {"ouml", 246}, {"para", 182},
+    {"part", 8706}, {"permil", 8240}, {"perp", 8869}, {"phi", 966},
+    {"pi", 960}, {"piv", 982}, {"plusmn", 177}, {"pound", 163},
+    {"prime", 8242}, {"prod", 8719}, {"prop", 8733}, {"psi", 968},
+    {"quot", 34}, {"rArr", 8658}, {"radic", 8730}, {"rang", 9002},
+    {"raquo", 187}, {"rarr", 8594}, {"rceil", 8969}, {"rdquo", 8221},
+    {"real", 8476}, {"reg", 174}, {"rfloor", 8971}, {"rho", 961},
+    {"rlm", 8207}, {"rsaquo", 8250}, {"rsquo", 8217}, {"sbquo", 8218},
+    {"scaron", 353}, {"sdot", 8901}, {"sect", 167}, {"shy", 173},
+    {"sigma", 963}, {"sigmaf", 962}, {"sim", 8764}, {"spades", 9824},
+    {"sub", 8834}, {"sube", 8838}, {"sum", 8721}, {"sup", 8835},
+    {"sup1", 185}, {"sup2", 178}, {"sup3", 179}, {"supe", 8839},
+    {"szlig", 223}, {"tau", 964}, {"there4", 8756}, {"theta", 952},
+    {"thetasym", 977}, {"thinsp", 8201}, {"thorn", 254}, {"tilde", 732},
+    {"times", 215}, {"trade", 8482}, {"uArr", 8657}, {"uacute", 250},
+    {"uarr", 8593}, {"ucirc", 251}, {"ugrave", 249}, {"uml", 168},
+    {"upsih", 978}, {"upsilon", 965}, {"uuml", 252}, {"weierp", 8472},
+    {"xi", 958}, {"yacute", 253}, {"yen", 165}, {"yuml", 255},
+    {"zeta", 950}, {"zwj", 8205}, {"zwnj", 8204},
+  };
+
+/*
+  Every name of the table is decoded, and names which are not in it (a
+  different case, a prefix or an extension of a name) are not.
+ */
+void
+test_entities()
+{
+  static_assert(sizeof(html_entities)/sizeof(*html_entities) == 253,
+		"253 named references");
+  set<string> names;
+  for(const auto &e : html_entities)
+    {
+      names.insert(e.name);
+      const unsigned char *name = (const unsigned char *)e.name;
+      if (xml_entity_code(name, strlen(e.name)) != e.code)
+	self_check(false, (string("&") + e.name + "; not decoded").c_str());
+    }
+
+  vector<string> others = {"", "AMP", "Amp", "ampx", "alefsymx", "thetasymb"};
+  for(const auto &e : html_entities)
+    others.push_back(string(e.name, strlen(e.name) - 1));
+  for(const string &other : others)
+    if (!names.count(other) &&
+	xml_entity_code((const unsigned char *)other.data(),
+			other.size()) != -1)
+      self_check(false, ("&" + other + "; decoded").c_str());
+}
+
+/*
+  Numeric references are put in the text in UTF-8, at the edges of each
+  encoded length.  Zero, surrogates and codes above 0x10FFFF are
+  refused with an error (printed as the reader prints it) and give "?".
+ */
+void
+test_numeric_references()
+{
+  static const struct
+  {
+    const char *ref;
+    const char *text;
+    unsigned errors;
+  } cases[] =
+    {
+      {"&#65;", "A", 0},
+      {"&#x7F;", "\x7f", 0},
+      {"&#x80;", "\xc2\x80", 0},
+      {"&#x7FF;", "\xdf\xbf", 0},
+      {"&#x800;", "\xe0\xa0\x80", 0},
+      {"&#8364;", "\xe2\x82\xac", 0},
+      {"&euro;", "\xe2\x82\xac", 0},
+      {"&#xD7FF;", "\xed\x9f\xbf", 0},
+      {"&#xE000;", "\xee\x80\x80", 0},
+      {"&#xFFFF;", "\xef\xbf\xbf", 0},
+      {"&#x10000;", "\xf0\x90\x80\x80", 0},
+      {"&#x1F600;", "\xf0\x9f\x98\x80", 0},
+      {"&#x10FFFF;", "\xf4\x8f\xbf\xbf", 0},
+      {"&#0;", "?", 1},
+      {"&#xD800;", "?", 1},
+      {"&#xDFFF;", "?", 1},
+      {"&#x110000;", "?", 1},
+      {"&#99999999999;", "?", 1},
+    };
+
+  for(const auto &c : cases)
+    {
+      string doc = string("<t>") + c.ref + "</t>";
+      basic_read_xml<> X[1];
+      X->init_mem(doc.data(), doc.size(), c.ref);
+      string text;
+      while (!X->eof)
+	if (bump_xml_node(X) == xml_node_text)
+	  text += X->text;
+      if (text != c.text || X->errors != c.errors)
+	self_check(false, (string(c.ref) + " not decoded").c_str());
+      done_read_xml(X);
+    }
+}
+
+int
+self_test()
+{
+  test_lazy_location_limit();
+  test_token_limit();
+  test_unpark_refused();
+  test_view_interning();
+  test_entities();
+  test_numeric_references();
+
+  fprintf(stderr, "self-test finished with %u failures\n",
+	  self_test_failures);
+  return self_test_failures != 0;
+}
+
+
 int
 main(int argc, char *argv[])
 {
@@ -191,6 +1231,13 @@ main(int argc, char *argv[])
 
   vector<xml_token_t> my_stack;
 
+  if (argc > 2 && 0 == strcmp(argv[1], "--bench"))
+    return bench(atoi(argv[2]), argc > 3 ? atoi(argv[3]) : 1);
+  if (argc > 1 && 0 == strcmp(argv[1], "--compare"))
+    return compare();
+  if (argc > 1 && 0 == strcmp(argv[1], "--self-test"))
+    return self_test();
+
   for (nfiles=0; fgets(fname, sizeof(fname), stdin); ++nfiles)
     {
       fname[strcspn(fname, "\n")] = 0;      
@@ -198,8 +1245,14 @@ main(int argc, char *argv[])
 
       if (io != -1)
 	{
-	  struct read_xml_t X[1];
-	  init_read_xml(X, io, fname);
+	  /*
+	    The reader grows over the default limits, so the used sizes
+	    printed at the end are the ones the corpus needs.
+	   */
+	  basic_read_xml<xml_default_limits_t, true> X[1];
+	  X->init_mmap(io, fname);
+	  set_read_xml_known_tokens(X, known_token);
+	  set_read_xml_name_tokens(X, name_token);
 
 	  while (!X->eof)
 	    {
@@ -266,6 +1319,9 @@ main(int argc, char *argv[])
 		used_stack = X->stack_size;
 	    }
 
+	  done_read_xml(X);
+	  close(io);
+
 	  errors += X->errors;
 	  if (errors != 0)
 	    break;
@@ -305,7 +1361,11 @@ main(int argc, char *argv[])
       a1->second.kind = kinds.insert(kind1);
     }
 
-  // render
+  // render, the code goes after the vocabulary it uses
+  char *code_buf = 0;
+  size_t code_size = 0;
+  FILE *code = open_memstream(&code_buf, &code_size);
+
   for(mined_info_t::iterator
 	a1 = mined_info.begin(), a2 = mined_info.end();
       a1 != a2; ++a1)
@@ -315,70 +1375,71 @@ main(int argc, char *argv[])
 	{
 	  if (kind == kind_struct)
 	    {
-	      printf("static int\n");
-	      printf("struct_%s(struct converter_t *X, "
-		     "xml_token_t tag_token,\n", xml_token_name(a1->first));
-	      printf("     xml_token_t val_token, const char *text)\n");
-	      printf("{\n");
-	      printf("  switch(tag_token)\n");
-	      printf("    {\n");
+	      fprintf(code, "static int\n");
+	      fprintf(code, "struct_%s(struct converter_t *X, "
+			   "xml_token_t tag_token,\n", c_name(a1->first).c_str());
+	      fprintf(code, "     xml_token_t val_token, const char *text)\n");
+	      fprintf(code, "{\n");
+	      fprintf(code, "  switch(tag_token)\n");
+	      fprintf(code, "    {\n");
 	      for(member_set_t::iterator
 		    b1 = a1->second.members.begin(),
 		    b2 = a1->second.members.end();
 		  b1 != b2; ++b1)
 		{
 		  mined_info_t::iterator node = mined_info.find(*b1);
-		  const char *name = xml_token_name(*b1);
+		  string name = c_name(*b1);
 		  if (node != mined_info.end())
 		    {
-		      const char *ref_type =
-			xml_token_name(node->second.kind.first->second.same_as);
+		      string ref_type =
+			c_name(node->second.kind.first->second.same_as);
 		      switch(node->second.kind.first->second.type)
 			{
 			case kind_number:
-			  printf("    case t_%s:\n"
-				 "      put_u16(X, 0x0001, strtol(text));\n"
-				 "      break;\n"
-				 "\n", name);
+			  fprintf(code, "    case t_%s:\n"
+				       "      put_u16(X, 0x0001, strtol(text));\n"
+				       "      break;\n"
+				       "\n", name.c_str());
 			  break;
 			case kind_string:
-			  printf("    case t_%s:\n"
-				 "      put_str(X, 0x0001, text);\n"
-				 "      break;\n"
-				 "\n", name);
+			  fprintf(code, "    case t_%s:\n"
+				       "      put_str(X, 0x0001, text);\n"
+				       "      break;\n"
+				       "\n", name.c_str());
 			  break;
 			case kind_enum:
-			  printf("    case t_%s:\n"
-				 "      put_u8(X, 0x0001, enum_%s(val_token));\n"
-				 "      break;\n"
-				 "\n", name, ref_type);
+			  fprintf(code, "    case t_%s:\n"
+				       "      put_u8(X, 0x0001, enum_%s(val_token));\n"
+				       "      break;\n"
+				       "\n", name.c_str(), ref_type.c_str());
 			  break;
 			default:
-			  printf("    case t_%s:\n"
-				 "      convert(X, 0x8000, struct_%s);\n"
-				 "      break;\n"
-				 "\n", name, ref_type);
+			  fprintf(code, "    case t_%s:\n"
+				       "      convert(X, 0x8000, struct_%s);\n"
+				       "      break;\n"
+				       "\n", name.c_str(), ref_type.c_str());
 			  break;
 			}
 		    }
 		  else
-		    printf("    /* unknown type \"%s\" */\n", name);
+		    fprintf(code, "    /* unknown type \"%s\" */\n", name.c_str());
 		}
 	      
-	      printf("    default: return -1;\n");
-	      printf("    }\n");
-	      printf("   return 0;\n");
-	      printf("}\n");
-	      printf("\n");
-	      printf("\n");
+	      fprintf(code, "    default: return -1;\n");
+	      fprintf(code, "    }\n");
+	      fprintf(code, "   return 0;\n");
+	      fprintf(code, "}\n");
+	      fprintf(code, "\n");
+	      fprintf(code, "\n");
 	    }
 	  else if (kind == kind_enum)
 	    {
-	      printf("static unsigned char\n");
-	      printf("enum_%s(xml_token_t val_token)\n", xml_token_name(a1->first));
-	      printf("{\n");
-	      printf("  switch(val_token)\n");
-	      printf("    {\n");
+	      fprintf(code, "static unsigned char\n");
+	      fprintf(code, "enum_%s(xml_token_t val_token)\n",
+			   c_name(a1->first).c_str());
+	      fprintf(code, "{\n");
+	      fprintf(code, "  switch(val_token)\n");
+	      fprintf(code, "    {\n");
 
 	      unsigned num = 0;
 	      for(member_set_t::iterator
@@ -386,62 +1447,84 @@ main(int argc, char *argv[])
 		    b2 = a1->second.members.end();
 		  b1 != b2; ++b1)
 		{
-		  const char *name = xml_token_name(*b1);
-		  printf("    case t_%s: return %u;\n", name, num++);		 
+		  string name = c_name(*b1);
+		  fprintf(code, "    case t_%s: return %u;\n", name.c_str(), num++);		 
 		}
 	      
-	      printf("    default: return 255;\n");
-	      printf("    }\n");
-	      printf("}\n");
-	      printf("\n");
-	      printf("\n");
+	      fprintf(code, "    default: return 255;\n");
+	      fprintf(code, "    }\n");
+	      fprintf(code, "}\n");
+	      fprintf(code, "\n");
+	      fprintf(code, "\n");
 	    }
 	}
     }
   
 
-  printf("Used tokens:\n");
-  // collect hashtab statistics
-  unsigned hash_fill = 0;
-  unsigned hash_worst = 0;
-  for(unsigned n=0; n<token_hashtab_size; ++n)
+  fclose(code);
+
+  /*
+    The used tokens get fixed values by a vocabulary, so the case labels
+    are constants.  The converters intern its names first.
+   */
+  printf("#include \"read_xml_vocabulary.h\"\n");
+  printf("\n");
+  printf("static constexpr const char *vocabulary_names[] =\n");
+  printf("  {\n");
+  for(unsigned t = 0; t < token_used.size(); ++t)
+    if (token_used[t])
+      printf("    \"%s\",\n", c_string(t).c_str());
+  printf("  };\n");
+  printf("\n");
+  printf("static constexpr auto vocabulary =\n"
+	 "  make_xml_vocabulary(vocabulary_names);\n");
+  printf("\n");
+  printf("enum vocabulary_token_t\n");
+  printf("  {\n");
+  for(unsigned t = 0, num = 0; t < token_used.size(); ++t)
+    if (token_used[t])
+      printf("    t_%s = %u,\n", c_name(t).c_str(), num++);
+  printf("  };\n");
+  printf("\n");
+  printf("\n");
+  fwrite(code_buf, 1, code_size, stdout);
+  free(code_buf);
+
+  if (argc > 2 && 0 == strcmp(argv[1], "--save-tokens"))
     {
-      unsigned s = token_hashtab[n];
-      if (s)
+      int io = open(argv[2], O_WRONLY | O_CREAT | O_TRUNC, 0644);
+      if (io == -1 || !save_xml_token_table(&token_table, io))
 	{
-	  ++hash_fill;
-	  unsigned this_case;
-	  for (this_case = 0; s; s = tokens[s - 1].next)
-	    {
-	      if (tokens[s - 1].is_used)
-		printf("  %s\n", tokens[s - 1].str);
-	      ++this_case;
-	    }
-
-	  if (hash_worst < this_case)
-	    hash_worst = this_case;
+	  fprintf(stderr, "%s \"%s\" %s\n",
+		  "token snapshot", argv[2], "not saved");
+	  ++errors;
 	}
+      if (io != -1)
+	close(io);
     }
+
+  struct xml_token_stats_t stats;
+  xml_token_table_stats(&token_table, &stats);
   
   fprintf(stderr, "\n");
   fprintf(stderr, "processed %u files\n", (nfiles));
   fprintf(stderr, "finished with %u errors\n", (errors));
   fprintf(stderr, "sizeof(read_xml_t) = %u\n", sizeof(read_xml_t));
-  fprintf(stderr, "symbols_size = %u\n", tokens.size());
+  fprintf(stderr, "symbols_size = %u\n", stats.tokens);
   fprintf(stderr, "used_bindings = %u\n", used_bindings);
   fprintf(stderr, "used_binding_text = %u\n", used_binding_text);
   fprintf(stderr, "used_text = %u\n", used_text);
   fprintf(stderr, "used_attrs = %u\n", used_attrs);
   fprintf(stderr, "used_stack = %u\n", used_stack);
 
-  if (hash_fill)
+  if (stats.slots)
     {
-      fprintf(stderr, "hash_size = %u\n", token_hashtab_size);
+      fprintf(stderr, "hash_size = %u\n", stats.slots);
       fprintf(stderr, "hash_fill = %u%%\n",
-	      100*hash_fill/token_hashtab_size);
-      fprintf(stderr, "hash_avg_case = %u\n",
-	      (tokens.size() + hash_fill/2)/hash_fill);
-      fprintf(stderr, "hash_worst_case = %u\n", hash_worst);
+	      100*stats.tokens/stats.slots);
+      fprintf(stderr, "hash_avg_case = %u.%02u\n",
+	      stats.avg_probes_x100/100, stats.avg_probes_x100%100);
+      fprintf(stderr, "hash_worst_case = %u\n", stats.worst_probes);
     }
         
   return 0;
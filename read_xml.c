@@ -1,8 +1,86 @@
 #include "read_xml.h"
+#include "read_xml_scan.h"
+#include "read_xml_ent.h"
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <unistd.h>
-#include <ctype.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <pthread.h>
+
+/*i
+@section Character classes
+
+The lexer classifies bytes by a constant table rather than by
+@code{<ctype.h>}, so parsing does not depend on the current locale.
+Bytes above 126 (parts of UTF-8 sequences) are allowed in identifiers
+as they were in the ``C'' locale.
+ */
+enum
+  {
+    char_alnum = 1,		/* ASCII letters and digits */
+    char_id = 2,		/* identifier characters */
+    char_literal = 4,		/* plain characters inside literals */
+  };
+
+static const unsigned char _char_class[256] =
+  {
+    ['\t'] = char_literal,
+    [' ' ... '!'] = char_literal,
+    ['#' ... '%'] = char_literal,
+    ['\'' ... ','] = char_literal,
+    ['-' ... '.'] = char_literal | char_id,
+    ['/'] = char_literal,
+    ['0' ... '9'] = char_literal | char_id | char_alnum,
+    [':' ... '@'] = char_literal,
+    ['A' ... 'Z'] = char_literal | char_id | char_alnum,
+    ['[' ... '^'] = char_literal,
+    ['_'] = char_literal | char_id,
+    ['`'] = char_literal,
+    ['a' ... 'z'] = char_literal | char_id | char_alnum,
+    ['{' ... '~'] = char_literal,
+    [127 ... 255] = char_literal | char_id,
+  };
+
+static FILE*
+_messg(struct read_xml_t *X,
+       struct xml_location_t *loc,
+       const char *type);
+
+static inline unsigned
+_hash(const unsigned char *s, unsigned len);
+
+static void
+_flush_messg(struct read_xml_t *X);
+
+static enum xml_node_type_t
+_bump_xml_node(struct read_xml_t *X);
+
+static void
+_set_mark(struct read_xml_t *X);
+
+static void
+_done_input(struct read_xml_t *X);
+
+static void
+_take_given(struct read_xml_t *X);
+
+static void
+_use_fixed(struct read_xml_t *X);
+
+static void
+_free_grown(struct read_xml_t *X);
+
+static unsigned
+_ahead_window(struct read_xml_t *X, const unsigned char **window);
+
+static FILE*
+_messg_header(FILE *out,
+	      const char *source,
+	      struct xml_location_t *loc,
+	      const char *type);
 
 static FILE*
 parser_lex_error(struct read_xml_t *X);
@@ -16,7 +94,10 @@ parser_fatal_error(struct read_xml_t *X);
 static void
 _end_of_open_tag(struct read_xml_t *X);
 
-static void
+static bool
+_text_view(struct read_xml_t *X);
+
+static bool
 _read_text(struct read_xml_t *X);
 
 static enum xml_node_type_t
@@ -53,8 +134,59 @@ _read_attr_id(struct read_xml_t *X,
 /*i
 @chapter Text reader
 
-A buffered text reader is used.
+A buffered text reader is used.  The input is consumed by windows: a
+window is either the I/O buffer filled by @code{read()} or a part of
+in-memory input which is served in place without copying.
  */
+static unsigned
+_next_window(struct read_xml_t *X, const unsigned char **window)
+{
+  if (X->in_left)
+    {
+      unsigned nread = (X->in_left < mem_window_size) ?
+	X->in_left : mem_window_size;
+      *window = X->in_next;
+      X->in_next += nread;
+      X->in_left -= nread;
+      X->in_carry = false;
+      return nread;
+    }
+
+  if (X->ahead)
+    return _ahead_window(X, window);
+
+  /*i
+In push mode the end of fed data is not the end of document until it
+is told so.
+   */
+  if (X->io == -1)
+    {
+      X->starved = X->push && !X->push_end;
+      return 0;
+    }
+
+  unsigned nread = read(X->io, X->io_mem, X->io_mem_size);
+  *window = X->io_mem;
+  return (nread - 1 < X->io_mem_size) ? nread : 0;
+}
+
+
+/*i
+Line numbers are counted while reading unless the reader is in lazy
+mode or locations are dropped at build time.
+ */
+static inline bool
+_tracks_lines(struct read_xml_t *X)
+{
+#ifdef XML_NO_LOCATIONS
+  (void)X;
+  return false;
+#else
+  return !X->lazy_loc;
+#endif
+}
+
+
 static int
 _getc(struct read_xml_t *X)
 {
@@ -64,16 +196,25 @@ During parsing text locations are tracked for each parsed item.
   if (X->loc.col_no != X->end_col_no)
     return X->line_start[X->loc.col_no++];
 
-  unsigned nread = read(X->io, X->io_buf, sizeof(X->io_buf));
-  if (nread - 1 < sizeof(X->io_buf))
+  const unsigned char *window;
+  unsigned nread = _next_window(X, &window);
+  if (nread)
     {
+#ifdef XML_NO_LOCATIONS
+      /*i
+Without locations the column is only a cursor, so it is restarted with
+each window and never overflows.
+       */
+      X->loc.col_no = 0;
+#endif
       X->beg_col_no = X->loc.col_no;
-      X->line_start = X->io_buf - X->beg_col_no;
+      X->line_start = window - X->beg_col_no;
       X->end_col_no = X->beg_col_no + nread;
       return X->line_start[X->loc.col_no++];
     }
 
-  X->eof = true;
+  if (!X->starved)
+    X->eof = true;
   return -1;
 }
 
@@ -81,27 +222,58 @@ During parsing text locations are tracked for each parsed item.
 static void
 _ungetc(struct read_xml_t *X)
 {
-  if (X->beg_col_no != X->loc.col_no)
+  /*i
+Nothing was read at the end of input, so there is nothing to put back.
+   */
+  if (X->beg_col_no != X->loc.col_no && !X->eof)
     --X->loc.col_no;
 }
 
 
+/*i
+The unread rest of the current window is a contiguous span from
+@code{_span_beg} to @code{_span_end}.  Hot loops scan the span directly
+and fall back to @code{_getc} only at its edge.  Line feeds found inside
+the span are counted by the scanning code.
+ */
+static inline const unsigned char *
+_span_beg(struct read_xml_t *X)
+{
+  return X->line_start + X->loc.col_no;
+}
+
+
+static inline const unsigned char *
+_span_end(struct read_xml_t *X)
+{
+  return X->line_start + X->end_col_no;
+}
+
+
 static void
-_got_newline(struct read_xml_t *X)
+_got_newlines(struct read_xml_t *X,
+	      unsigned count)
 {
   /*i
 Each new line symbol @kbd{LF} increases line counter but we can track
 a limited count of lines.  When the limit is reached the counter is
 freezed.
    */
-  if (X->loc.line_no < max_line_no)
-    ++X->loc.line_no;
-  else if (!X->warned_about_max_line_no)
+  if (!_tracks_lines(X))
+    return;
+
+  if (max_line_no - X->loc.line_no >= count)
+    X->loc.line_no += count;
+  else
     {
-      X->warned_about_max_line_no = true;
-      fprintf(parser_messg(X->source, &X->loc, "note"),
-	      "%s\n",
-	      "this is the last tracked line number");
+      X->loc.line_no = max_line_no;
+      if (!X->warned_about_max_line_no)
+	{
+	  X->warned_about_max_line_no = true;
+	  fprintf(_messg(X, &X->loc, "note"),
+		  "%s\n",
+		  "this is the last tracked line number");
+	}
     }
 
   /*i
@@ -114,18 +286,381 @@ Any way column number is restarting to 0 (index before the first symbol).
 }
 
 
+static inline void
+_got_newline(struct read_xml_t *X)
+{
+  _got_newlines(X, 1);
+}
+
+
+/*i
+Moves the cursor forward to @var{to} inside the current window.  All
+@kbd{LF} in between are counted at once and the column is restarted
+after the last of them.
+ */
+static void
+_skip_to(struct read_xml_t *X,
+	 const unsigned char *to)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *last;
+  unsigned n = _tracks_lines(X) ? xml_count_lines(p, to, &last) : 0;
+  if (n)
+    {
+      X->loc.col_no += last + 1 - p;
+      _got_newlines(X, n);
+      p = last + 1;
+    }
+  X->loc.col_no += to - p;
+}
+
+
+/*i
+Moves to the next window when the current one is exhausted.  Returns
+false at the end of input.
+ */
+static bool
+_skip_window(struct read_xml_t *X)
+{
+  if (_getc(X) == -1)
+    return false;
+  _ungetc(X);
+  return true;
+}
+
+
+/*i
+Skips the rest of a comment up to and including ``-->''.  The windows
+are searched for ``>'' by @code{memchr} and only the dashes before it
+are looked at.
+ */
+static void
+_skip_comment(struct read_xml_t *X)
+{
+  unsigned n = 0;		/* dashes before the current position */
+  for(;;)
+    {
+      const unsigned char *p = _span_beg(X);
+      const unsigned char *end = _span_end(X);
+      const unsigned char *gt = memchr(p, '>', end - p);
+      const unsigned char *to = gt ? gt : end;
+      const unsigned char *d = to;
+
+      while (d != p && d[-1] == '-')
+	--d;
+      n = d == p ? n + (to - p) : to - d;
+
+      _skip_to(X, to);
+      if (gt)
+	{
+	  ++X->loc.col_no;
+	  /*i
+Please break repeating ``-'' more then 2 times inside comments to
+avoid unwanted ``-->'' (which will end the comment).
+	   */
+	  if (n >= 2)
+	    return;
+	  n = 0;
+	}
+      else if (!_skip_window(X))
+	{
+	  fprintf(parser_error(X),
+		  "%s\n",
+		  "missing \"-->\"");
+	  return;
+	}
+    }
+}
+
+
+/*i
+@section CDATA sections
+
+The content of a section is not copied: it comes as one or more
+@code{xml_node_cdata} nodes, each a view in @code{view} into the
+input window, the last one with @code{last_chunk} set.  A section which
+is contiguous in the input is a single node.  Otherwise it is split at
+the window edges, and the pieces may be empty.  The view is valid
+until the next call on the reader.
+
+Up to two ``]'' at the end of a window may start the ``]]>'', so they
+are held back in @code{cdata_held} until the next window tells.
+ */
+static bool
+_cdata_open(struct read_xml_t *X)
+{
+  const char *s;
+  for (s = "CDATA["; *s; ++s)
+    if (*s != _getc(X))
+      return false;
+  return true;
+}
+
+
+static enum xml_node_type_t
+_close_cdata(struct read_xml_t *X,
+	     const unsigned char *str, unsigned len, bool last)
+{
+  X->view.str = (const char *)str;
+  X->view.len = len;
+  X->view.hash = 0;
+  X->last_chunk = last;
+  X->state = last ? xml_read__text : xml_read__cdata;
+  return xml_node_cdata;
+}
+
+
+static enum xml_node_type_t
+_read_cdata(struct read_xml_t *X)
+{
+  static const unsigned char brackets[] = "]]";
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  const unsigned char *q;
+  unsigned held = X->cdata_held;
+
+  if (p == end)
+    {
+      if (!_skip_window(X))
+	{
+	  if (X->starved)
+	    return xml_node_need_more;
+	  fprintf(parser_error(X),
+		  "%s\n",
+		  "missing \"]]>\"");
+	  X->cdata_held = 0;
+	  return _close_cdata(X, brackets, held, true);
+	}
+      p = _span_beg(X);
+      end = _span_end(X);
+    }
+
+  /*i
+The held ``]'' are content unless the window goes on with the rest of
+``]]>''.
+   */
+  while (held)
+    {
+      if (p == end)
+	return _close_cdata(X, p, 0, false);
+      if (held == 2 && *p == '>')
+	{
+	  ++X->loc.col_no;
+	  X->cdata_held = 0;
+	  return _close_cdata(X, p, 0, true);
+	}
+      if (*p != ']')
+	{
+	  X->cdata_held = 0;
+	  return _close_cdata(X, brackets, held, false);
+	}
+      ++X->loc.col_no;
+      ++p;
+      if (held == 2)
+	return _close_cdata(X, brackets, 1, false);
+      X->cdata_held = held = 2;
+    }
+
+  q = xml_scan_cdata_end(p, end);
+  if (q != end)
+    {
+      _skip_to(X, q);
+      X->loc.col_no += 3;
+      return _close_cdata(X, p, q - p, true);
+    }
+
+  for (q = end; held < 2 && q != p && q[-1] == ']'; --q)
+    ++held;
+  _skip_to(X, end);
+  X->cdata_held = held;
+  return _close_cdata(X, p, q - p, false);
+}
+
+
+/*i
+@section Growing buffers
+
+A growable reader (see @code{set_read_xml_growable}) doubles a full
+buffer on the heap instead of failing, up to 65535 entries.  The first
+growth copies the buffer out of the reader storage, later ones
+reallocate it.  @var{extra} entries are kept above the limit.  Returns
+the new buffer, or 0 when the buffer may not or can not hold
+@var{need} entries.  The growing functions are kept out of line, so
+the checks of a fixed reader stay small enough to be inlined.
+ */
+enum
+  {
+    grown_attrs = 1,
+    grown_stack = 2,
+    grown_bound = 4,
+    grown_text = 8,
+    grown_bound_text = 16,
+  };
+
+
+static void *
+_grow(struct read_xml_t *X, void *items, short unsigned *limit,
+      size_t item_size, unsigned extra, unsigned need, unsigned grown)
+{
+  unsigned size = *limit;
+  void *p;
+
+  if (!X->grow || need > 0xffff)
+    return 0;
+  while (size < need)
+    size = size < 0x8000 ? 2*size + 1 : 0xffff;
+
+  if (X->grown & grown)
+    p = realloc(items, (size + extra)*item_size);
+  else if ((p = malloc((size + extra)*item_size)))
+    memcpy(p, items, (*limit + extra)*item_size);
+  if (p == 0)
+    return 0;
+
+  *limit = size;
+  X->grown |= grown;
+  return p;
+}
+
+
+static bool __attribute__((noinline, cold))
+_grow_text(struct read_xml_t *X, unsigned need)
+{
+  char *text = _grow(X, X->text, &X->limits.text_size,
+		     sizeof(*X->text), 0, need, grown_text);
+  if (text)
+    X->text = text;
+  return text != 0;
+}
+
+
+static bool __attribute__((noinline, cold))
+_grow_bound_text(struct read_xml_t *X, unsigned need)
+{
+  char *text = _grow(X, X->bound_text, &X->limits.bound_text_size,
+		     sizeof(*X->bound_text), 0, need, grown_bound_text);
+  if (text)
+    X->bound_text = text;
+  return text != 0;
+}
+
+
+static bool __attribute__((noinline, cold))
+_grow_attrs(struct read_xml_t *X)
+{
+  struct xml_attr_t *attrs =
+    _grow(X, X->attrs, &X->limits.attrs_size, sizeof(*X->attrs), 1,
+	  X->limits.attrs_size + 1, grown_attrs);
+  if (attrs)
+    X->attrs = attrs;
+  return attrs != 0;
+}
+
+
+static bool __attribute__((noinline, cold))
+_grow_stack(struct read_xml_t *X, unsigned need)
+{
+  struct xml_stack_node_t *stack =
+    _grow(X, X->stack, &X->limits.stack_size, sizeof(*X->stack), 0,
+	  need, grown_stack);
+  if (stack)
+    X->stack = stack;
+  return stack != 0;
+}
+
+
+static bool __attribute__((noinline, cold))
+_grow_bound(struct read_xml_t *X, unsigned need)
+{
+  struct xml_binding_t *bound =
+    _grow(X, X->bound, &X->limits.bound_size, sizeof(*X->bound), 0,
+	  need, grown_bound);
+  if (bound)
+    X->bound = bound;
+  return bound != 0;
+}
+
+
+/*i
+Names are interned apart from values when the reader is given a name
+interner, see @code{set_read_xml_name_tokens}.
+ */
+static xml_token_t
+_intern(struct read_xml_t *X, const char *str, unsigned hash, bool name)
+{
+  return name && X->name_token ?
+    X->name_token(str, hash) : xml_token_by_name(str, hash);
+}
+
+
+static xml_token_t
+_token_of(struct read_xml_t *X, const char *str, unsigned len, unsigned hash,
+	  bool name)
+{
+  xml_token_t token = X->known_token ?
+    X->known_token(str, len, hash) : not_a_token;
+  if (token == not_a_token)
+    token = _intern(X, str, hash, name);
+  return token;
+}
+
+
+/*i
+The same for a view, which is not null-terminated: it is copied for
+@code{xml_token_by_name} only when the recognizer does not know it.
+The copy is not put past the collected text, since growing the text
+would move the views already handed out.
+ */
+static xml_token_t
+_token_of_view(struct read_xml_t *X,
+	       const char *str, unsigned len, unsigned hash, bool name)
+{
+  char buf[256];
+  char *copy;
+  xml_token_t token = X->known_token ?
+    X->known_token(str, len, hash) : not_a_token;
+  if (token != not_a_token)
+    return token;
+
+  copy = len < sizeof(buf) ? buf : malloc(len + 1);
+  if (copy == 0)
+    {
+      fprintf(parser_lex_error(X),
+	      "%s %u %s\n",
+	      "no memory to intern", len, "bytes");
+      return not_a_token;
+    }
+  memcpy(copy, str, len);
+  copy[len] = 0;
+  token = _intern(X, copy, hash, name);
+  if (copy != buf)
+    free(copy);
+  return token;
+}
+
+
+/*i
+Values (text and attribute literals) are interned only when
+@var{intern} is set, see @code{set_read_xml_intern_values}.
+ */
 static void
-_close_text(struct read_xml_t *X)
+_close_text(struct read_xml_t *X, bool intern, bool name)
 {
   /*i
 All text collected by the parser is null-terminated.  Also the text 
-length and hash is known at load time.
+length and hash is known at load time: the hash is computed once over
+the whole run.
    */
-  if (X->text_size != (max_text_size - 1))
+  if (X->text_size != (X->limits.text_size - 1) ||
+      _grow_text(X, X->text_size + 2))
     {
+      X->text_hash = _hash((unsigned char *)X->text + X->lex_text_index,
+			   X->text_size - X->lex_text_index);
       X->text[X->text_size++] = 0;      
-      X->lex_symbol =
-	xml_token_by_name((X->text + X->lex_text_index), X->text_hash);      
+      X->lex_symbol = intern ?
+	_token_of(X, (X->text + X->lex_text_index),
+		  X->text_size - 1 - X->lex_text_index, X->text_hash, name) :
+	not_a_token;
     }
   else
     {
@@ -136,98 +671,1369 @@ limited.
       X->text_size = X->lex_text_index;
       X->text[X->lex_text_index] = 0;
       X->lex_symbol = not_a_token;
+      X->view.len = 0;
+      X->view.hash = 0;
       fprintf(parser_lex_error(X),
 	      "%s %u %s\n",
 	      "too much text, please set \"max_text_size\" to",
-	      (2*max_text_size), "or more");
+	      (2*X->limits.text_size), "or more");
     }  
 }
 
 
+/*i
+Closes a piece of a text over the buffer, see
+@code{set_read_xml_text_chunks}.
+ */
+static enum xml_node_type_t
+_close_chunk(struct read_xml_t *X, bool last)
+{
+  X->text[X->text_size++] = 0;
+  X->text_hash = 0;
+  X->lex_symbol = not_a_token;
+  X->last_chunk = last;
+  if (last)
+    X->state = xml_read__text;
+  return xml_node_text_chunk;
+}
+
+
 static void
 _add_text(struct read_xml_t *X, int c)
 {
-  /*i
-Hashing is used faster string comparsion.  Every read string is
-automatically hashed during reading.
-   */
-  X->text_hash = 33*X->text_hash + c;
-  
-  if (X->text_size != (max_text_size - 1))
+  if (X->text_size != (X->limits.text_size - 1) ||
+      _grow_text(X, X->text_size + 2))
     X->text[X->text_size++] = c;
 }
 
+
 /*i
-The following iterative
-algorithm is applied to calculate hash:
+The same as @code{_add_text} for the whole run from the cursor to
+@var{end} inside the current window.  The cursor is moved to
+@var{end}.
  */
-unsigned
-string_hash(const char *str)
+static inline void
+_add_run(struct read_xml_t *X,
+	 const unsigned char *p,
+	 const unsigned char *end)
 {
-  const unsigned char *s;
-  unsigned hash = 0;
+  unsigned size = end - p;
+  unsigned room = (X->limits.text_size - 1) - X->text_size;
+
+  X->loc.col_no += size;
+
+  if (size >= room && _grow_text(X, X->text_size + size + 2))
+    room = (X->limits.text_size - 1) - X->text_size;
+  if (size > room)
+    size = room;
+  memcpy(X->text + X->text_size, p, size);
+  X->text_size += size;
+}
+
+/*i
+@section Hashing
 
+Hashing is used faster string comparsion.  Every read string is hashed
+once when it is closed, over the whole run, by the algorithm chosen
+with @code{XML_HASH}.
+ */
+static inline unsigned
+_hash(const unsigned char *s, unsigned len)
+{
+#if XML_HASH == XML_HASH_FNV1A
+  unsigned hash = 2166136261u;
+  for(; len; --len)
+    hash = (hash ^ *s++) * 16777619u;
+  return hash;
+#elif XML_HASH == XML_HASH_WORD
+  /*i
+The word hash takes 8 bytes per step, so names of usual length are
+hashed in one or two multiplications.  The length is mixed in first so
+the zero padding of the tail does not make names equal.
+   */
+  uint64_t hash = len * 0x9e3779b97f4a7c15ull;
+  uint64_t w;
+  for(; len >= 8; s += 8, len -= 8)
+    {
+      memcpy(&w, s, 8);
+      hash = (hash ^ w) * 0xff51afd7ed558ccdull;
+      hash ^= hash >> 32;
+    }
+  /*i
+The tail of 4 to 7 bytes is taken by two overlapping loads, a shorter
+one by its first, middle and last bytes.
+   */
+  if (len >= 4)
+    {
+      uint32_t a, b;
+      memcpy(&a, s, 4);
+      memcpy(&b, s + len - 4, 4);
+      w = (uint64_t)a << 32 | b;
+    }
+  else if (len)
+    w = (uint64_t)s[0] << 16 | (uint64_t)s[len >> 1] << 8 | s[len - 1];
+  else
+    w = 0;
+  hash = (hash ^ w) * 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 29;
+  return (unsigned)(hash ^ (hash >> 32));
+#else
   /*i
 @example
 hash(0, str) = 0
 hash(i + 1, str) = 33 * hash(i, str) + str[i]
 @end example
    */
-  for(s = (unsigned char*)str; *s; ++s)
-    hash = 33*hash + (*s);
-  
+  unsigned hash = 0;
+  for(; len; --len)
+    hash = 33*hash + *s++;
   return hash;
+#endif
 }
 
-void
-init_read_xml(struct read_xml_t *X, int io1, const char *name1)
+
+unsigned
+xml_hash(const char *data, unsigned len)
 {
-  X->io = io1;
-  X->source = name1;
-  X->line_start = X->io_buf;
-  X->loc.line_no = 1;
-  X->loc.col_no = 0;
-  X->tag_loc.line_no = 1;
-  X->tag_loc.col_no = 1;
-  X->lex_loc.line_no = 1;
-  X->lex_loc.col_no = 1;
-  X->beg_col_no = 0;
-  X->end_col_no = 0;
+  return _hash((const unsigned char *)data, len);
+}
 
-  /*i
-When parser can not recognize ``xmlns'' token no bindings are available.
-   */
-  X->xmlns = xml_token_by_name("xmlns", 146349010);
-  if (X->xmlns == not_a_token)
+
+unsigned
+string_hash(const char *str)
+{
+  return _hash((const unsigned char *)str, strlen(str));
+}
+
+/*i
+Per-document state is reset separately from the reader setup, so one
+reader can parse many documents one after another.
+ */
+static void
+_reset_read_xml(struct read_xml_t *X)
+{
+  unsigned line_no = _tracks_lines(X) ? 1 : 0;
+
+  X->line_start = X->io_mem;
+  X->loc.line_no = line_no;
+  X->loc.col_no = 0;
+  X->tag_loc.line_no = line_no;
+  X->tag_loc.col_no = 1;
+  X->lex_loc.line_no = line_no;
+  X->lex_loc.col_no = 1;
+  X->beg_col_no = 0;
+  X->end_col_no = 0;
+
+  X->ending_loc.line_no = line_no;
+  X->ending_loc.col_no = 1;
+
+  X->lazy_line_no = 1;
+  X->lazy_line_off = 0;
+  X->lazy_off = 0;
+
+  X->bound_size = 1;  
+  X->bound_text_size = 1;
+  
+  X->stack_size = 0;
+  X->text_size = 0;
+  X->attrs_size = 0;
+  X->errors = 0;
+  X->state = xml_read__text;
+  
+  X->warned_about_max_line_no = false;
+  X->warned_about_max_col_no = false;
+  X->warned_about_unresolved = false;
+  X->warned_abount_unknown_tag_balance = false;
+  X->last_chunk = false;
+  X->cdata_held = 0;
+  X->eof = false;
+}
+
+
+void
+init_read_xml(struct read_xml_t *X, int io1, const char *name1)
+{
+  X->io = io1;
+  X->ahead = 0;
+  X->in_next = 0;
+  X->in_left = 0;
+  X->map_addr = 0;
+  X->map_size = 0;
+  X->feed_data = 0;
+  X->feed_size = 0;
+  X->carry_size = 0;
+  X->messg = 0;
+  X->messg_pending = false;
+  X->push = false;
+  X->push_end = false;
+  X->starved = false;
+  X->in_carry = false;
+  X->lazy_loc = false;
+  X->known_token = 0;
+  X->name_token = 0;
+  X->intern_values = true;
+  X->text_chunks = false;
+  X->views = false;
+
+  /*i
+Every init takes the storage and the I/O buffer of the reader itself,
+so it is safe on a reader never used before.  Other ones are given
+after it.
+   */
+  X->grow = false;
+  X->grown = 0;
+  _use_fixed(X);
+
+  X->source = name1;
+  _reset_read_xml(X);
+
+  /*i
+The file is read sequentially from the start to the end, so the kernel
+is asked for aggressive read-ahead.  The hint is ignored for pipes and
+sockets.
+   */
+#ifdef POSIX_FADV_SEQUENTIAL
+  if (io1 != -1)
+    posix_fadvise(io1, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+  /*i
+When parser can not recognize ``xmlns'' token no bindings are available.
+   */
+  X->xmlns = xml_token_by_name("xmlns", string_hash("xmlns"));
+  if (X->xmlns == not_a_token)
+    {
+      fprintf(_messg(X, &X->lex_loc, "warning"),
+	      "%s\n"
+	      "have no \"xmlns\" symbol, xml bindings are unavailable");
+    }
+}
+
+
+/*i
+A document which is already in memory (a message from a queue, output
+of a decompressor) is parsed in place, without copying.  The data must
+stay unchanged until the document is parsed.
+ */
+void
+init_read_xml_mem(struct read_xml_t *X,
+		  const char *data, size_t len, const char *name1)
+{
+  init_read_xml(X, -1, name1);
+  X->in_next = (const unsigned char *)data;
+  X->in_left = len;
+}
+
+
+/*i
+The next in-memory document can be parsed by the same reader.  Only
+the per-document state is reset, the predefined tokens, the limits and
+the buffers are kept.  It is cheap enough to parse thousands of small
+messages per second.
+ */
+void
+reset_read_xml_mem(struct read_xml_t *X,
+		   const char *data, size_t len, const char *name1)
+{
+  _done_input(X);
+  X->io = -1;
+  X->push = false;
+  X->starved = false;
+  X->source = name1;
+  /*i
+Offsets are column numbers, so they are unsigned; the enum constant
+alone would be -1 and compare as the largest @code{size_t}.
+   */
+  if (len >= (unsigned)max_col_no)
+    X->lazy_loc = false;
+  _reset_read_xml(X);
+  X->in_next = (const unsigned char *)data;
+  X->in_left = len;
+}
+
+
+/*i
+Most documents produce no messages, so for in-memory and mapped input
+line numbers can be left uncounted until a message needs them.  In lazy
+mode the reader keeps only byte offsets: line feeds are not looked for
+while reading, and a location is resolved by counting line feeds from
+the last resolved offset.  Locations given to the caller (@var{loc},
+@var{tag_loc} and others) hold offsets too and are resolved by
+@code{resolve_xml_location}.
+
+The mode must be set before the first node is read and is kept by
+@code{reset_read_xml_mem}.  It is refused for file descriptors and push
+mode, whose data is gone by the time a message is printed, and for
+documents of 4GB or more.
+ */
+bool
+set_read_xml_lazy_locations(struct read_xml_t *X)
+{
+#ifdef XML_NO_LOCATIONS
+  (void)X;
+  return false;
+#else
+  if (X->io != -1 || X->push || X->end_col_no != 0 ||
+      X->in_left >= (unsigned)max_col_no)
+    return false;
+
+  X->lazy_loc = true;
+  _reset_read_xml(X);
+  return true;
+#endif
+}
+
+
+/*i
+Names known in advance (tags and attributes of a fixed schema) may be
+recognized without @code{xml_token_by_name}: the reader asks
+@var{known} first and calls @code{xml_token_by_name} only for names it
+does not know.  Both must give the same token for a name.  The
+recognizer is kept by @code{reset_read_xml_mem}.
+ */
+void
+set_read_xml_known_tokens(struct read_xml_t *X, xml_known_token_t *known)
+{
+  X->known_token = known;
+}
+
+
+/*i
+Tokens of names (tags, attributes and namespace names) outlive their
+node: open tags keep them on the stack and bindings keep them until
+the tag closes.  A token table which reclaims tokens (see
+@code{set_xml_token_limit}) must keep them, so names may be interned by
+@var{names} instead of @code{xml_token_by_name}, for example by one
+calling @code{intern_xml_name}.  Values are still interned by
+@code{xml_token_by_name}.  The interner is kept by
+@code{reset_read_xml_mem}.
+ */
+void
+set_read_xml_name_tokens(struct read_xml_t *X, xml_name_token_t *names)
+{
+  X->name_token = names;
+}
+
+
+/*i
+By default every text and attribute value is interned like names are.
+High-cardinality values (timestamps, IDs) make the token table grow
+without bound, so interning of values may be turned off: names are
+still interned, values come with @code{not_a_token} and are available
+by @code{xml_text_value} and @code{xml_attr_value}, and may be interned
+on demand by @code{intern_xml_text} and @code{intern_xml_attr_value}.
+Namespace names given by ``xmlns'' attributes are always interned.  The
+mode is kept by @code{reset_read_xml_mem}.
+ */
+void
+set_read_xml_intern_values(struct read_xml_t *X, bool intern)
+{
+  X->intern_values = intern;
+}
+
+
+/*i
+By default a plain text over the text buffer is an error and is
+dropped.  In chunked mode such a text comes by pieces of up to the
+buffer size as @code{xml_node_text_chunk} nodes, the last one with
+@code{last_chunk} set, so a reader with a small buffer takes base64
+payloads of any size.  Words are joined as in a single text node, a
+word may be split between pieces.  Pieces are not hashed nor interned:
+@code{text_hash} is zero and @code{lex_symbol} is @code{not_a_token}.
+A text which fits the buffer is still a single @code{xml_node_text}.
+
+The text buffer must be of 16 bytes or more.  In push mode the input
+of a piece must still fit the I/O buffer.  The mode is kept by
+@code{reset_read_xml_mem}.
+ */
+void
+set_read_xml_text_chunks(struct read_xml_t *X, bool chunks)
+{
+  X->text_chunks = chunks;
+}
+
+
+/*i
+Gives the reader other limits with the storage for them: @var{attrs}
+of @code{1 + limits->attrs_size} entries and the others of their limit
+each.  The storage must stay until @code{done_read_xml}.  It must be
+set after the reader is initialized and before the first node is read,
+and is kept by @code{reset_read_xml_mem}.
+ */
+void
+set_read_xml_limits(struct read_xml_t *X, const struct xml_limits_t *limits,
+		    struct xml_attr_t *attrs, struct xml_stack_node_t *stack,
+		    struct xml_binding_t *bound,
+		    char *text, char *bound_text)
+{
+  _free_grown(X);
+
+  /*i
+Initially only empty namespace (``'') is bound to empty alias.  The
+binding is never changed by parsing.
+   */
+  bound[0].name_index = 0;
+  bound[0].namesp_token = xml_token_by_name("", string_hash(""));
+  bound_text[0] = 0;
+
+  X->given.limits = *limits;
+  X->given.attrs = attrs;
+  X->given.stack = stack;
+  X->given.bound = bound;
+  X->given.text = text;
+  X->given.bound_text = bound_text;
+  _take_given(X);
+}
+
+
+static void
+_use_fixed(struct read_xml_t *X)
+{
+  static const struct xml_limits_t limits =
+    {
+      max_attrs_size,
+      max_bound_size,
+      max_stack_size,
+      max_text_size,
+      max_bound_text_size,
+    };
+
+  set_read_xml_limits(X, &limits, X->fixed.attrs, X->fixed.stack,
+		      X->fixed.bound, X->fixed.text, X->fixed.bound_text);
+  X->io_mem = X->fixed.io_buf;
+  X->io_mem_size = sizeof(X->fixed.io_buf);
+}
+
+
+/*i
+A growable reader doubles a full buffer on the heap instead of failing
+on a document over its limits, up to 65535 entries each.  The limits
+are then only the starting sizes.  The grown buffers are kept by
+@code{reset_read_xml_mem}, so a reader used for many documents
+allocates only for the largest one, and are freed by
+@code{done_read_xml}.
+ */
+void
+set_read_xml_growable(struct read_xml_t *X)
+{
+  X->grow = true;
+}
+
+
+/*i
+In views mode values are not copied when the input already holds them
+as they would be collected: a text with no escapes and words separated
+by single spaces, or a literal with no escapes which ends in the
+current window.  Such a value is a view into the input, given by
+@code{xml_text_view} and @code{xml_attr_view}, and is empty for
+@code{xml_text_value} and @code{xml_attr_value}.  Other values are
+still copied, and the view functions give them from the text buffer.
+Names are always copied, they are interned and resolved by their
+null-terminated copies.  A view value is interned from the input when
+the recognizer set by @code{set_read_xml_known_tokens} knows it, and
+is copied for @code{xml_token_by_name} otherwise.
+
+The views stay valid as long as the input.  The mode is refused for
+file descriptors and push mode, whose windows are reused, and is kept
+by @code{reset_read_xml_mem}.
+ */
+bool
+set_read_xml_views(struct read_xml_t *X, bool views)
+{
+  if (views && (X->io != -1 || X->push))
+    return false;
+  X->views = views;
+  return true;
+}
+
+
+/*i
+The value of the text node just read.
+ */
+struct xml_value_t
+xml_text_value(struct read_xml_t *X)
+{
+  struct xml_value_t value;
+  value.str = X->text;
+  value.len = X->text_size ? X->text_size - 1 : 0;
+  value.hash = X->text_hash;
+  return value;
+}
+
+
+/*i
+The value of an attribute of the tag just read.  The hash is computed
+by the call.
+ */
+struct xml_value_t
+xml_attr_value(struct read_xml_t *X, const struct xml_attr_t *attr)
+{
+  struct xml_value_t value;
+  value.str = X->text + attr->val_index;
+  value.len = strlen(value.str);
+  value.hash = _hash((const unsigned char *)value.str, value.len);
+  return value;
+}
+
+
+/*i
+The value of the text node just read as a view, see
+@code{set_read_xml_views}.
+ */
+struct xml_view_t
+xml_text_view(struct read_xml_t *X)
+{
+  struct xml_view_t view;
+  if (X->views && !X->text_size)
+    return X->view;
+  view.str = X->text;
+  view.len = X->text_size ? X->text_size - 1 : 0;
+  view.hash = X->text_hash;
+  return view;
+}
+
+
+/*i
+The value of an attribute of the tag just read as a view.  The hash is
+computed by the call.
+ */
+struct xml_view_t
+xml_attr_view(struct read_xml_t *X, const struct xml_attr_t *attr)
+{
+  struct xml_view_t view;
+  if (attr->val_view)
+    {
+      view.str = attr->val_view;
+      view.len = attr->val_view_len;
+    }
+  else
+    {
+      view.str = X->text + attr->val_index;
+      view.len = strlen(view.str);
+    }
+  view.hash = _hash((const unsigned char *)view.str, view.len);
+  return view;
+}
+
+
+xml_token_t
+intern_xml_text(struct read_xml_t *X)
+{
+  if (X->lex_symbol == not_a_token && X->text_size)
+    X->lex_symbol = _token_of(X, X->text, X->text_size - 1, X->text_hash,
+			      false);
+  else if (X->lex_symbol == not_a_token && X->views && X->view.len)
+    X->lex_symbol = _token_of_view(X, X->view.str, X->view.len,
+				   X->view.hash, false);
+  return X->lex_symbol;
+}
+
+
+xml_token_t
+intern_xml_attr_value(struct read_xml_t *X, struct xml_attr_t *attr)
+{
+  if (attr->val_token == not_a_token && attr->val_view)
+    {
+      struct xml_view_t view = xml_attr_view(X, attr);
+      attr->val_token = _token_of_view(X, view.str, view.len, view.hash,
+				       false);
+    }
+  else if (attr->val_token == not_a_token)
+    {
+      struct xml_value_t value = xml_attr_value(X, attr);
+      attr->val_token = _token_of(X, value.str, value.len, value.hash,
+				  false);
+    }
+  return attr->val_token;
+}
+
+
+struct xml_location_t
+resolve_xml_location(struct read_xml_t *X,
+		     const struct xml_location_t *loc)
+{
+  struct xml_location_t where = *loc;
+  if (!X->lazy_loc || where.line_no)
+    return where;
+
+  /*i
+The whole document stays addressable, and the window pointer is not
+moved by line feeds in lazy mode, so it is the document start.
+   */
+  const unsigned char *doc = X->line_start;
+  const unsigned char *last;
+  unsigned off = (where.col_no < X->end_col_no) ?
+    where.col_no : X->end_col_no;
+  unsigned n;
+
+  if (off < X->lazy_off)
+    {
+      X->lazy_line_no = 1;
+      X->lazy_line_off = 0;
+      X->lazy_off = 0;
+    }
+
+  n = xml_count_lines(doc + X->lazy_off, doc + off, &last);
+  if (n)
+    {
+      X->lazy_line_no += n;
+      X->lazy_line_off = (last + 1) - doc;
+    }
+  X->lazy_off = off;
+
+  where.line_no = X->lazy_line_no;
+  where.col_no -= X->lazy_line_off;
+  return where;
+}
+
+
+/*i
+The I/O buffer of the reader is small.  A larger buffer
+(up to several megabytes) can be given by the caller, for example taken
+from a pool, before the document is parsed: each @code{read()} then
+fills the whole buffer and the syscall overhead is amortized.  In push
+mode the buffer also limits the size of a node cut by the end of a
+fragment.  A reader of in-memory and mapped input only needs no buffer.
+
+The buffer must stay valid until the reader is done with.  It is given
+after the reader is initialized: the init functions take the buffer of
+the reader itself.
+ */
+void
+set_read_xml_buffer(struct read_xml_t *X, void *buf, unsigned size)
+{
+  X->io_mem = buf;
+  X->io_mem_size = size;
+  X->line_start = X->io_mem - X->beg_col_no;
+}
+
+
+/*i
+@section Read-ahead
+
+On cold-cache reads the parser stalls while the kernel fills the
+buffer.  With read-ahead a helper thread reads the next half of the
+given buffer while the parser consumes the other half, so I/O overlaps
+with lexing.  Each half is a usual reader window, the location
+tracking does not see any difference.
+
+Read-ahead must be started before the document is parsed, and only for
+descriptor input.  It is stopped by @code{done_read_xml}.
+ */
+struct xml_read_ahead_t
+{
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+
+  int io;
+  unsigned char *half[2];
+  unsigned half_size;
+  unsigned len[2];
+  bool full[2];
+
+  short current;
+  bool stop;
+  bool eof;
+};
+
+
+static void*
+_read_ahead(void *arg)
+{
+  struct xml_read_ahead_t *A = arg;
+  unsigned i = 0;
+
+  pthread_mutex_lock(&A->lock);
+  for(;;)
+    {
+      while (A->full[i] && !A->stop)
+	pthread_cond_wait(&A->cond, &A->lock);
+      if (A->stop)
+	break;
+      pthread_mutex_unlock(&A->lock);
+
+      unsigned nread = read(A->io, A->half[i], A->half_size);
+      if (nread - 1 >= A->half_size)
+	nread = 0;
+
+      pthread_mutex_lock(&A->lock);
+      A->len[i] = nread;
+      A->full[i] = true;
+      pthread_cond_broadcast(&A->cond);
+      /*i
+An empty half marks the end of file (or a read error).
+       */
+      if (!nread)
+	break;
+      i ^= 1;
+    }
+  pthread_mutex_unlock(&A->lock);
+  return 0;
+}
+
+
+static unsigned
+_ahead_window(struct read_xml_t *X, const unsigned char **window)
+{
+  struct xml_read_ahead_t *A = X->ahead;
+  unsigned next, nread;
+
+  if (A->eof)
+    return 0;
+
+  pthread_mutex_lock(&A->lock);
+  /*i
+The consumed half is given back to the helper thread.  The parser never
+looks back past the window start, so it is free now.
+   */
+  if (A->current >= 0)
+    {
+      A->full[A->current] = false;
+      pthread_cond_broadcast(&A->cond);
+    }
+
+  next = (A->current < 0) ? 0 : (A->current ^ 1);
+  while (!A->full[next])
+    pthread_cond_wait(&A->cond, &A->lock);
+
+  nread = A->len[next];
+  if (nread)
+    A->current = next;
+  else
+    {
+      A->current = -1;
+      A->eof = true;
+    }
+  pthread_mutex_unlock(&A->lock);
+
+  *window = A->half[next];
+  return nread;
+}
+
+
+/*i
+@return false if read-ahead can not be started; the reader then reads
+by itself.
+ */
+bool
+start_read_xml_ahead(struct read_xml_t *X, void *buf, unsigned size)
+{
+  struct xml_read_ahead_t *A;
+
+  if (X->io == -1 || X->ahead || size < 2)
+    return false;
+  A = malloc(sizeof(*A));
+  if (A == 0)
+    return false;
+
+  A->io = X->io;
+  A->half_size = size / 2;
+  A->half[0] = buf;
+  A->half[1] = A->half[0] + A->half_size;
+  A->full[0] = A->full[1] = false;
+  A->current = -1;
+  A->stop = false;
+  A->eof = false;
+
+  pthread_mutex_init(&A->lock, 0);
+  pthread_cond_init(&A->cond, 0);
+  if (pthread_create(&A->thread, 0, _read_ahead, A) != 0)
+    {
+      pthread_cond_destroy(&A->cond);
+      pthread_mutex_destroy(&A->lock);
+      free(A);
+      return false;
+    }
+
+  X->ahead = A;
+  return true;
+}
+
+
+static void
+_stop_read_ahead(struct read_xml_t *X)
+{
+  struct xml_read_ahead_t *A = X->ahead;
+
+  pthread_mutex_lock(&A->lock);
+  A->stop = true;
+  pthread_cond_broadcast(&A->cond);
+  pthread_mutex_unlock(&A->lock);
+
+  pthread_join(A->thread, 0);
+  pthread_cond_destroy(&A->cond);
+  pthread_mutex_destroy(&A->lock);
+  free(A);
+  X->ahead = 0;
+}
+
+
+/*i
+A regular file can be mapped into memory instead of being read by
+blocks.  The whole file then becomes a single window (or a few 1 GiB
+windows) and no bytes are copied.  Locations and diagnostics are the
+same as for the buffered reader.
+
+When the file can not be mapped (a pipe, a socket, an empty file) the
+buffered reader is used.
+
+@return true if the file is mapped.
+ */
+bool
+init_read_xml_mmap(struct read_xml_t *X, int io1, const char *name1)
+{
+  struct stat st;
+  void *addr;
+
+  init_read_xml(X, io1, name1);
+
+  if (fstat(io1, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0 ||
+      (unsigned long long)st.st_size != (size_t)st.st_size)
+    return false;
+
+  addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, io1, 0);
+  if (addr == MAP_FAILED)
+    return false;
+
+  posix_madvise(addr, st.st_size, POSIX_MADV_SEQUENTIAL);
+
+  /*i
+The file offset is not moved by mapping, so the descriptor is not read
+any more.
+   */
+  X->io = -1;
+  X->map_addr = addr;
+  X->map_size = st.st_size;
+  X->in_next = addr;
+  X->in_left = st.st_size;
+  return true;
+}
+
+
+/*i
+@section Push mode
+
+A reader can be fed with input fragments as they arrive (for example
+from a non-blocking socket) instead of pulling them with
+@code{read()}.  @code{bump_xml_node} returns nodes until the fed data
+runs out and then returns @code{xml_node_need_more}.
+
+Nothing blocks, so one thread can drive many readers.
+ */
+void
+init_read_xml_push(struct read_xml_t *X, const char *name1)
+{
+  init_read_xml(X, -1, name1);
+  X->push = true;
+  X->in_carry = true;
+  X->messg = open_memstream(&X->messg_buf, &X->messg_size);
+}
+
+
+/*i
+The fragment must stay unchanged until @code{xml_node_need_more} is
+returned for it.  An empty fragment marks the end of document.
+ */
+void
+xml_feed(struct read_xml_t *X, const char *data, size_t len)
+{
+  X->starved = false;
+  if (len == 0)
+    {
+      X->push_end = true;
+      return;
+    }
+
+  X->feed_data = data;
+  X->feed_size = len;
+  X->in_next = (const unsigned char *)data;
+  X->in_left = len;
+}
+
+
+static void
+_set_mark(struct read_xml_t *X)
+{
+  struct xml_read_mark_t *M = &X->mark;
+
+  if (X->messg_pending)
+    _flush_messg(X);
+
+  M->ptr = _span_beg(X);
+  M->loc = X->loc;
+  M->lex_loc = X->lex_loc;
+  M->tag_loc = X->tag_loc;
+  M->ending_loc = X->ending_loc;
+  M->errors = X->errors;
+  M->lex_token = X->lex_token;
+  M->attrs_size = X->attrs_size;
+  M->stack_size = X->stack_size;
+  M->bound_size = X->bound_size;
+  M->text_size = X->text_size;
+  M->bound_text_size = X->bound_text_size;
+  M->state = X->state;
+  M->in_carry = X->in_carry;
+  M->warned_about_max_line_no = X->warned_about_max_line_no;
+  M->warned_about_max_col_no = X->warned_about_max_col_no;
+  M->warned_about_unresolved = X->warned_about_unresolved;
+  M->warned_abount_unknown_tag_balance =
+    X->warned_abount_unknown_tag_balance;
+}
+
+
+/*i
+When the fed data ends inside a node the parser returns to the node
+start.  The partial tag, literal, escape or comment is moved into the
+I/O buffer and parsed again from there when the next fragment is fed.
+So in push mode a node (with preceding comments and spaces) can not be
+longer than the I/O buffer.
+ */
+static bool
+_rewind_to_mark(struct read_xml_t *X)
+{
+  struct xml_read_mark_t *M = &X->mark;
+  const char *rest;
+  size_t rest_size;
+  unsigned size = 0;
+
+  if (X->messg_pending)
+    {
+      rewind(X->messg);
+      X->messg_pending = false;
+    }
+
+  X->loc = M->loc;
+  X->lex_loc = M->lex_loc;
+  X->tag_loc = M->tag_loc;
+  X->ending_loc = M->ending_loc;
+  X->errors = M->errors;
+  X->lex_token = M->lex_token;
+  X->attrs_size = M->attrs_size;
+  X->stack_size = M->stack_size;
+  X->bound_size = M->bound_size;
+  X->text_size = M->text_size;
+  X->bound_text_size = M->bound_text_size;
+  X->state = M->state;
+  X->warned_about_max_line_no = M->warned_about_max_line_no;
+  X->warned_about_max_col_no = M->warned_about_max_col_no;
+  X->warned_about_unresolved = M->warned_about_unresolved;
+  X->warned_abount_unknown_tag_balance =
+    M->warned_abount_unknown_tag_balance;
+
+  if (M->in_carry)
+    {
+      size = X->carry_size - (M->ptr - X->io_mem);
+      memmove(X->io_mem, M->ptr, size);
+      rest = X->feed_data;
+    }
+  else
+    rest = (const char *)M->ptr;
+
+  rest_size = (X->feed_data + X->feed_size) - rest;
+  if (rest_size > X->io_mem_size - size)
+    {
+      fprintf(parser_error_loc(X, &X->loc),
+	      "%s %u %s\n",
+	      "too long node for push mode, please use I/O buffer of",
+	      (2*X->io_mem_size), "bytes or more");
+      _flush_messg(X);
+      X->starved = false;
+      X->eof = true;
+      return false;
+    }
+
+  if (rest_size)
+    memcpy(X->io_mem + size, rest, rest_size);
+  size += rest_size;
+
+  X->feed_data = 0;
+  X->feed_size = 0;
+  X->carry_size = size;
+  X->in_carry = true;
+  X->beg_col_no = X->loc.col_no;
+  X->line_start = X->io_mem - X->beg_col_no;
+  X->end_col_no = X->beg_col_no + size;
+  return true;
+}
+
+
+/*i
+Releases the mapping (if any) and stops read-ahead.  The descriptor is
+owned by the caller and is not closed.
+ */
+static void
+_done_input(struct read_xml_t *X)
+{
+  if (X->ahead)
+    _stop_read_ahead(X);
+  if (X->map_addr)
+    {
+      munmap(X->map_addr, X->map_size);
+      X->map_addr = 0;
+      X->map_size = 0;
+    }
+  if (X->messg)
+    {
+      if (X->messg_pending)
+	_flush_messg(X);
+      fclose(X->messg);
+      free(X->messg_buf);
+      X->messg = 0;
+    }
+  X->in_next = 0;
+  X->in_left = 0;
+}
+
+
+static void
+_take_given(struct read_xml_t *X)
+{
+  X->attrs = X->given.attrs;
+  X->stack = X->given.stack;
+  X->bound = X->given.bound;
+  X->text = X->given.text;
+  X->bound_text = X->given.bound_text;
+  X->limits = X->given.limits;
+}
+
+
+/*i
+Grown buffers are freed and the given storage is taken back, so the
+reader is still usable by @code{reset_read_xml_mem}.
+ */
+static void
+_free_grown(struct read_xml_t *X)
+{
+  if (X->grown & grown_attrs)
+    free(X->attrs);
+  if (X->grown & grown_stack)
+    free(X->stack);
+  if (X->grown & grown_bound)
+    free(X->bound);
+  if (X->grown & grown_text)
+    free(X->text);
+  if (X->grown & grown_bound_text)
+    free(X->bound_text);
+  if (X->grown)
+    _take_given(X);
+  X->grown = 0;
+}
+
+
+void
+done_read_xml(struct read_xml_t *X)
+{
+  _done_input(X);
+  _free_grown(X);
+}
+
+
+/*i
+@section Parking
+
+A stream waiting for input (a push reader which returned
+@code{xml_node_need_more}, or any reader between nodes) can be parked:
+its state is moved out of the reader into a small block, and the
+reader with its buffers is free to parse another stream.  The block
+keeps only what outlives a node: the reader fields before the storage
+(@code{offsetof(struct read_xml_t, fixed)}, 456 of the 3672 bytes of a
+reader on x86-64 with 16 bit tokens), the open tags, the namespace
+bindings and the unread input held in the I/O buffer.  A parked stream is resumed by @code{unpark_read_xml} in
+any free reader, so with a pool of readers (see
+@code{borrow_xml_reader}) memory follows the count of streams being
+parsed, not the count of open ones.
+
+The current node is dropped: its text and attributes must be used
+before parking.  A reader with read-ahead can not be parked.
+
+@return the parked stream, or 0 if the reader can not be parked.
+ */
+struct xml_parked_t *
+park_read_xml(struct read_xml_t *X)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  uintptr_t buf = (uintptr_t)X->io_mem;
+  bool in_buf = buf <= (uintptr_t)p &&
+    (uintptr_t)end <= buf + X->io_mem_size;
+  size_t window = in_buf ? end - p : 0;
+  size_t stack = X->stack_size*sizeof(*X->stack);
+  size_t bound = X->bound_size*sizeof(*X->bound);
+  struct xml_parked_t *P;
+  unsigned char *data;
+
+  if (X->ahead)
+    return 0;
+  P = malloc(sizeof(*P) + stack + bound + X->bound_text_size + window);
+  if (P == 0)
+    return 0;
+
+  /*i
+The message stream of a push reader writes into the reader itself, so
+it is closed and opened again by @code{unpark_read_xml}.  Between nodes
+it holds no messages.
+   */
+  if (X->messg)
+    {
+      if (X->messg_pending)
+	_flush_messg(X);
+      fclose(X->messg);
+      free(X->messg_buf);
+      X->messg = 0;
+    }
+  X->text_size = X->lex_text_index = 0;
+  X->attrs_size = 0;
+
+  memcpy(P->core, X, sizeof(P->core));
+  P->tag = X->attrs[0];
+  P->stack_size = X->stack_size;
+  P->bound_size = X->bound_size;
+  P->bound_text_size = X->bound_text_size;
+  P->window = window;
+  P->in_buf = in_buf;
+
+  data = P->data;
+  memcpy(data, X->stack, stack);
+  data += stack;
+  memcpy(data, X->bound, bound);
+  data += bound;
+  memcpy(data, X->bound_text, X->bound_text_size);
+  data += X->bound_text_size;
+  memcpy(data, p, window);
+
+  /*i
+The mapping and the rest of the input go with the parked stream.
+   */
+  X->map_addr = 0;
+  X->map_size = 0;
+  X->in_next = 0;
+  X->in_left = 0;
+  _free_grown(X);
+  return P;
+}
+
+
+/*i
+Resumes a parked stream in @var{X}, which must be free: just borrowed,
+or parked or done with.  The storage of @var{X} is used, a growable
+stream may grow it.  @var{P} is freed.
+
+@return false if the stream does not fit the storage of @var{X};
+@var{P} and @var{X} are kept then.  Everything is checked before
+@var{X} is changed; only when the memory to grow runs out @var{X} may
+be left with grown (and still free) storage.
+ */
+bool
+unpark_read_xml(struct read_xml_t *X, struct xml_parked_t *P)
+{
+  struct xml_attr_t *attrs;
+  struct xml_stack_node_t *stack;
+  struct xml_binding_t *bound;
+  char *text;
+  char *bound_text;
+  struct xml_limits_t limits;
+  unsigned char *io_mem;
+  unsigned io_mem_size;
+  struct xml_storage_t given;
+  unsigned char grown;
+  bool grow;
+  bool fits;
+  const unsigned char *data = P->data;
+
+  memcpy(&grow, P->core + offsetof(struct read_xml_t, grow), sizeof(grow));
+  fits = (P->stack_size <= X->limits.stack_size &&
+	  P->bound_size <= X->limits.bound_size &&
+	  P->bound_text_size <= X->limits.bound_text_size);
+  if (P->window > X->io_mem_size || (!fits && !grow))
+    return false;
+
+  if (!fits)
+    {
+      bool was_growable = X->grow;
+
+      X->grow = true;
+      if ((P->stack_size > X->limits.stack_size &&
+	   !_grow_stack(X, P->stack_size)) ||
+	  (P->bound_size > X->limits.bound_size &&
+	   !_grow_bound(X, P->bound_size)) ||
+	  (P->bound_text_size > X->limits.bound_text_size &&
+	   !_grow_bound_text(X, P->bound_text_size)))
+	{
+	  X->grow = was_growable;
+	  return false;
+	}
+    }
+
+  /*i
+The fields of the storage are the ones of @var{X}, all others are of
+the stream.
+   */
+  attrs = X->attrs;
+  stack = X->stack;
+  bound = X->bound;
+  text = X->text;
+  bound_text = X->bound_text;
+  limits = X->limits;
+  io_mem = X->io_mem;
+  io_mem_size = X->io_mem_size;
+  given = X->given;
+  grown = X->grown;
+
+  memcpy(X, P->core, sizeof(P->core));
+
+  X->attrs = attrs;
+  X->stack = stack;
+  X->bound = bound;
+  X->text = text;
+  X->bound_text = bound_text;
+  X->limits = limits;
+  X->io_mem = io_mem;
+  X->io_mem_size = io_mem_size;
+  X->given = given;
+  X->grown = grown;
+
+  X->attrs[0] = P->tag;
+  memcpy(X->stack, data, P->stack_size*sizeof(*X->stack));
+  data += P->stack_size*sizeof(*X->stack);
+  memcpy(X->bound, data, P->bound_size*sizeof(*X->bound));
+  data += P->bound_size*sizeof(*X->bound);
+  memcpy(X->bound_text, data, P->bound_text_size);
+  data += P->bound_text_size;
+
+  /*i
+Unread input of the I/O buffer is put at its start, and the window is
+moved with it.
+   */
+  if (P->in_buf)
+    {
+      memcpy(X->io_mem, data, P->window);
+      X->beg_col_no = X->loc.col_no;
+      X->line_start = X->io_mem - X->beg_col_no;
+      X->end_col_no = X->beg_col_no + P->window;
+      if (X->in_carry)
+	X->carry_size = P->window;
+    }
+
+  if (X->push)
+    X->messg = open_memstream(&X->messg_buf, &X->messg_size);
+
+  free(P);
+  return true;
+}
+
+
+/*i
+Frees a parked stream without resuming it.  The descriptor is owned by
+the caller and is not closed.
+ */
+void
+done_parked_xml(struct xml_parked_t *P)
+{
+  void *map_addr;
+  size_t map_size;
+
+  memcpy(&map_addr, P->core + offsetof(struct read_xml_t, map_addr),
+	 sizeof(map_addr));
+  memcpy(&map_size, P->core + offsetof(struct read_xml_t, map_size),
+	 sizeof(map_size));
+  if (map_addr)
+    munmap(map_addr, map_size);
+  free(P);
+}
+
+
+/*i
+A pool keeps free readers for parked streams to be resumed in.  A
+reader is borrowed to parse a stream for a while and returned when the
+stream is parked or done; a new stream is started in a borrowed reader
+by one of the @code{init_read_xml} functions.  The pool may be shared
+by threads.
+
+@return false if there is no memory for the pool.
+ */
+struct xml_pool_lock_t
+{
+  pthread_mutex_t mutex;
+};
+
+
+bool
+init_xml_reader_pool(struct xml_reader_pool_t *pool)
+{
+  pool->lock = malloc(sizeof(*pool->lock));
+  if (pool->lock == 0)
+    return false;
+  pthread_mutex_init(&pool->lock->mutex, 0);
+  pool->free = 0;
+  pool->free_size = 0;
+  pool->free_capacity = 0;
+  return true;
+}
+
+
+void
+done_xml_reader_pool(struct xml_reader_pool_t *pool)
+{
+  unsigned i;
+  for(i = 0; i < pool->free_size; ++i)
+    {
+      done_read_xml(pool->free[i]);
+      free(pool->free[i]);
+    }
+  free(pool->free);
+  pool->free = 0;
+  pool->free_size = 0;
+  pool->free_capacity = 0;
+  pthread_mutex_destroy(&pool->lock->mutex);
+  free(pool->lock);
+  pool->lock = 0;
+}
+
+
+/*i
+A new reader is initialized, which gives it its own storage, before it
+is lent.
+
+@return a free reader, or 0 if there is no memory for a new one.
+ */
+struct read_xml_t *
+borrow_xml_reader(struct xml_reader_pool_t *pool)
+{
+  struct read_xml_t *X = 0;
+
+  pthread_mutex_lock(&pool->lock->mutex);
+  if (pool->free_size)
+    X = pool->free[--pool->free_size];
+  pthread_mutex_unlock(&pool->lock->mutex);
+
+  if (X == 0 && (X = malloc(sizeof(*X))))
+    init_read_xml(X, -1, "");
+  return X;
+}
+
+
+void
+return_xml_reader(struct xml_reader_pool_t *pool, struct read_xml_t *X)
+{
+  pthread_mutex_lock(&pool->lock->mutex);
+  if (pool->free_size == pool->free_capacity)
     {
-      fprintf(parser_messg(X->source, &X->lex_loc, "warning"),
-	      "%s\n"
-	      "have no \"xmlns\" symbol, xml bindings are unavailable");
+      unsigned capacity = 2*pool->free_capacity + 8;
+      struct read_xml_t **readers =
+	realloc(pool->free, capacity*sizeof(*readers));
+      if (readers == 0)
+	{
+	  pthread_mutex_unlock(&pool->lock->mutex);
+	  done_read_xml(X);
+	  free(X);
+	  return;
+	}
+      pool->free = readers;
+      pool->free_capacity = capacity;
     }
-
-  X->ending_loc.line_no = 1;
-  X->ending_loc.col_no = 1;
-  
-  /*i
-Initially only empty namespace (``'') is bound to empty alias.
-   */
-  X->bound[0].name_index = 0;
-  X->bound[0].namesp_token = xml_token_by_name("", 0);
-  X->bound_size = 1;  
-  X->bound_text[0] = 0;
-  X->bound_text_size = 1;
-  
-  X->stack_size = 0;
-  X->text_size = 0;
-  X->attrs_size = 0;
-  X->errors = 0;
-  X->state = xml_read__text;
-  
-  X->warned_about_max_line_no = false;
-  X->warned_about_max_col_no = false;
-  X->warned_about_unresolved = false;
-  X->warned_abount_unknown_tag_balance = false;
-  X->eof = false;
+  pool->free[pool->free_size++] = X;
+  pthread_mutex_unlock(&pool->lock->mutex);
 }
 
 
@@ -236,12 +2042,44 @@ Initially only empty namespace (``'') is bound to empty alias.
  */
 enum xml_node_type_t
 bump_xml_node(struct read_xml_t *X)
+{
+  enum xml_node_type_t node;
+
+  if (!X->push)
+    return _bump_xml_node(X);
+
+  if (X->starved)
+    return xml_node_need_more;
+
+  _set_mark(X);
+  node = _bump_xml_node(X);
+  if (!X->starved)
+    {
+      if (X->messg_pending)
+	_flush_messg(X);
+      return node;
+    }
+
+  if (!_rewind_to_mark(X))
+    return xml_node_close;
+  return xml_node_need_more;
+}
+
+
+static enum xml_node_type_t
+_bump_xml_node(struct read_xml_t *X)
 {
   if (X->state == xml_read__end_of_tag)
     {
-      _end_of_open_tag(X);
-      return xml_node_close;
+      X->state = xml_read__text;
+      if (X->lex_token == '/')
+	{
+	  _end_of_open_tag(X);
+	  return xml_node_close;
+	}
     }
+  if (X->state == xml_read__cdata)
+    return _read_cdata(X);
   
   /*i
 Each XML document contains structured tags and plain text.
@@ -249,15 +2087,32 @@ Each XML document contains structured tags and plain text.
 
   for(;;)
     {
+      /*i
+In push mode each skipped comment or instruction ends at a point where
+parsing can be resumed.
+       */
+      if (X->starved)
+	return xml_node_need_more;
+      if (X->push)
+	_set_mark(X);
+
       X->text_size = X->lex_text_index = 0;
       X->attrs_size = 0;
 
-      _read_text(X);
+      if (X->views && X->state == xml_read__text && _text_view(X))
+	return xml_node_text;
+      if (_read_text(X))
+	return _close_chunk(X, false);
+      if (X->state != xml_read__text)
+	{
+	  _ungetc(X);
+	  return _close_chunk(X, true);
+	}
 
       if (X->text_size)
 	{
 	  _ungetc(X);
-	  _close_text(X);
+	  _close_text(X, X->intern_values, false);
 	  X->state == xml_read__text;
 	  return xml_node_text;
 	}
@@ -265,12 +2120,13 @@ Each XML document contains structured tags and plain text.
 Structured data tags are limited in folding depth.
        */
       X->tag_loc = X->loc;
-      if (X->stack_size == max_stack_size)
+      if (X->stack_size == X->limits.stack_size &&
+	  !_grow_stack(X, X->limits.stack_size + 1))
 	{
 	  fprintf(parser_attr_error(X),
 		  "%s %u %s\n",
 		  "too deep node, please set \"max_stack_size\" to",
-		  (2*max_stack_size), "or more");
+		  (2*X->limits.stack_size), "or more");
 	  return -1;
 	}
       /*
@@ -287,39 +2143,26 @@ The following structured data tags are available:
       int c = _getc(X);
       if (0) ;
       /*i
-@item Comments
+@item Comments and CDATA sections
 
 @example
 <!-- ...  -->
+<![CDATA[ ... ]]>
 @end example
        */
       else if (c == '!')
 	{
-	  if ('-' == (c = _getc(X)) && '-' == (c = _getc(X)))
+	  c = _getc(X);
+	  if (c == '-')
 	    {
-	      unsigned n;
-	      do
+	      if ('-' == (c = _getc(X)))
 		{
-		  /*i
-Please break repeating ``-'' more then 2 times inside comments to
-avoid unwanted ``-->'' (which will end the comment).
-		   */
-		  for(n = 0; '-' == (c = _getc(X)); ++n);
-		  
-	          if (c == '\n')
-		    _got_newline(X);
-		  
-		  if (c == -1)
-		    {
-		      fprintf(parser_error(X),
-			      "%s\n",
-			      "missing \"-->\"");
-		      break;
-		    }
+		  _skip_comment(X);
+		  continue;
 		}
-	      while (c != '>' || n < 2);
-	      continue;
 	    }
+	  else if (c == '[' && _cdata_open(X))
+	    return _read_cdata(X);
 	}
       /*i
 @item DTD or processing instructions
@@ -356,7 +2199,7 @@ Note: ``</ >'' is an invalid tag.
 		  fprintf(parser_attr_error(X),
 			  "%s\n",
 			  "closing tag must be ended with \">\"");
-		  fprintf(parser_messg(X->source, &X->attrs[0].loc, "note"),
+		  fprintf(_messg(X, &X->attrs[0].loc, "note"),
 			  "%s\n",
 			  "here was \"</\"");
 		}
@@ -439,12 +2282,15 @@ static void
 _ignore_rest_tag(struct read_xml_t *X)
 {
   int c;
-  while ('>' != (c = _getc(X)) && c != -1)
+  while (X->want_warn_end_of_tag)
     {
+      if ('>' == (c = _getc(X)) || c == -1)
+	return;
+
       if (c == '\n')
 	_got_newline(X);
 
-      if (X->want_warn_end_of_tag && ' ' < c)
+      if (' ' < c)
 	{
 	  X->want_warn_end_of_tag = false;
 	  fprintf(parser_error(X),
@@ -452,14 +2298,164 @@ _ignore_rest_tag(struct read_xml_t *X)
 		  "extra text");
 	}
     }
+
+  /*i
+Nothing is reported any more so the rest is skipped by windows.
+   */
+  for(;;)
+    {
+      const unsigned char *p = _span_beg(X);
+      const unsigned char *end = _span_end(X);
+      const unsigned char *gt = memchr(p, '>', end - p);
+
+      _skip_to(X, gt ? gt : end);
+      if (gt)
+	{
+	  ++X->loc.col_no;
+	  return;
+	}
+      if (!_skip_window(X))
+	return;
+    }
+}
+
+
+/*i
+Words and space runs inside the current input window are consumed at
+once (see ``Byte scanners'').  The rest is read by @code{_getc}.
+ */
+static void
+_add_word(struct read_xml_t *X)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  const unsigned char *s;
+
+  /*i
+Short words are common, so a word which ends within a machine word is
+not passed to the vector scanner.
+   */
+  for(s = p; s != end && s - p < 8; ++s)
+    if (*s <= ' ' || *s == '<' || *s == '&')
+      break;
+  if (s - p == 8)
+    s = xml_scan_word(s, end);
+
+  /*i
+In chunked mode the rest of a word which would fill the buffer is left
+for the next piece, so the buffer does not grow.
+   */
+  if (X->text_chunks)
+    {
+      unsigned room = (X->limits.text_size - 1u) - X->text_size;
+      if ((unsigned)(s - p) >= room)
+	s = p + room - 1;
+    }
+
+  _add_run(X, p, s);
 }
 
 
 static void
+_skip_spaces(struct read_xml_t *X)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  const unsigned char *lf;
+
+  /*i
+Usually words are separated by a single space, which is already read.
+   */
+  if (p == end || ' ' < *p)
+    return;
+
+  end = xml_scan_space(p, end);
+
+  while ((_tracks_lines(X) || X->push) &&
+	 0 != (lf = memchr(p, '\n', end - p)))
+    {
+      X->loc.col_no += (lf + 1) - p;
+      p = lf + 1;
+      _got_newline(X);
+      if (X->push && !X->text_size)
+	_set_mark(X);
+    }
+  X->loc.col_no += end - p;
+}
+
+
+/*i
+In chunked mode a piece is closed when the buffer may not take one more
+space and escape.  At least one byte is taken each time, so a piece is
+never empty.
+ */
+static inline bool
+_chunk_full(struct read_xml_t *X)
+{
+  return X->text_chunks && X->text_size &&
+    X->text_size + 5u > X->limits.text_size - 1u;
+}
+
+
+/*i
+In views mode a text is taken in place when it ends in the current
+window and is already as @code{_read_text} would collect it.
+@return true when the text is taken; the cursor is then at ``<''.
+Otherwise only the leading spaces may have been skipped.
+ */
+static bool
+_text_view(struct read_xml_t *X)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  const unsigned char *lt = memchr(p, '<', end - p);
+  const unsigned char *b;
+  const unsigned char *s;
+  const unsigned char *t;
+
+  if (!lt)
+    return false;
+  b = xml_scan_space(p, lt);
+  if (b == lt)
+    return false;
+
+  for (s = b; (s = xml_scan_word(s, lt)) != lt; s = t)
+    {
+      if (*s == '&')
+	return false;
+      t = xml_scan_space(s, lt);
+      if (t == lt)
+	break;
+      if (t != s + 1 || *s != ' ')
+	return false;
+    }
+
+  _skip_to(X, lt);
+  X->view.str = (const char *)b;
+  X->view.len = s - b;
+  X->view.hash = X->text_hash = _hash(b, s - b);
+  X->lex_symbol = X->intern_values ?
+    _token_of_view(X, X->view.str, X->view.len, X->view.hash, false) :
+    not_a_token;
+  return true;
+}
+
+
+/*i
+@return true when a piece of a chunked text is full; the rest of the
+text is read by the next call.
+ */
+static bool
 _read_text(struct read_xml_t *X)
 {
   int c;
   /*i
+A text continued from a full piece goes on with a new word, or inside
+the word the piece was closed in.
+   */
+  bool space = X->state == xml_read__chunk_space;
+  bool word = X->state == xml_read__chunk_word;
+  /*i
 Plain text can not include ``<'', ``>'' characters which are used to
 indicate non-plain tag inside docment.
   */
@@ -472,46 +2468,103 @@ The text consists of words and spaces, and consequent spaces are
 joined together in a signle space character.  The leading and trailing
 spaces inside one structured node are trimmed.
 	  */	      
-	  if (X->text_size)
+	  if (_chunk_full(X))
+	    {
+	      _ungetc(X);
+	      X->state = xml_read__chunk_space;
+	      return true;
+	    }
+	  if ((X->text_size || space) && !word)
 	    _add_text(X, ' ');
+	  word = false;
 
 	  do
 	    {
+	      if (_chunk_full(X))
+		{
+		  _ungetc(X);
+		  X->state = xml_read__chunk_word;
+		  return true;
+		}
 	      /*i
 Ampersand is also a special symbol which is used to encode escapes
 which are mapped to symbols.  Those symbols are assumed to be 
 non-spaces.
 	      */		  
 	      if (c != '&')
-		_add_text(X, c);
+		{
+		  _add_text(X, c);
+		  _add_word(X);
+		}
 	      else
 		_read_esc(X);
 
 	      c = _getc(X);
 	      if ('<' == c)
-		return;
+		return false;
 	    }
 	  while (' ' < c);
 	}
 	  
       if (c == '\n')
-	_got_newline(X);
+	{
+	  _got_newline(X);
+	  /*i
+In push mode a line of leading spaces is a point where parsing can be
+resumed too.
+	   */
+	  if (X->push && !X->text_size)
+	    _set_mark(X);
+	}
       
       if (c == -1)
-	break;	  	  
+	break;
+
+      _skip_spaces(X);
     }     
+  return false;
 }
 
 /*i
 @section Escapes
  */
+/*i
+Decoded characters are appended to the text in UTF-8.
+ */
+static void
+_add_utf8(struct read_xml_t *X, unsigned code)
+{
+  if (code < 0x80)
+    _add_text(X, code);
+  else if (code < 0x800)
+    {
+      _add_text(X, 0xc0 | (code >> 6));
+      _add_text(X, 0x80 | (code & 0x3f));
+    }
+  else if (code < 0x10000)
+    {
+      _add_text(X, 0xe0 | (code >> 12));
+      _add_text(X, 0x80 | ((code >> 6) & 0x3f));
+      _add_text(X, 0x80 | (code & 0x3f));
+    }
+  else
+    {
+      _add_text(X, 0xf0 | (code >> 18));
+      _add_text(X, 0x80 | ((code >> 12) & 0x3f));
+      _add_text(X, 0x80 | ((code >> 6) & 0x3f));
+      _add_text(X, 0x80 | (code & 0x3f));
+    }
+}
+
+
 static void
 _read_esc(struct read_xml_t *X)
 {
   struct xml_location_t loc;
-  unsigned esc_len;
+  unsigned char esc[max_esc_length];
+  const unsigned char *name, *p, *end, *s;
+  unsigned esc_len, code;
   int c, esc_type;
-  char esc[max_esc_length + 1];
 
   loc = X->loc;
   /* _save_loc(X, &loc); */
@@ -523,118 +2576,111 @@ All escapes must be ended with ``;'' symbol.
   if ('#' != (esc_type = _getc(X)))    
     _ungetc(X);
 
-  for(esc_len = 0; ';' != (c = _getc(X)); )
+  /*i
+Usually the whole escape is inside the current window, so it is
+decoded in place.
+   */
+  p = _span_beg(X);
+  end = _span_end(X);
+  for(s = p; s != end && s - p < max_esc_length &&
+	(_char_class[*s] & char_alnum); ++s);
+
+  if (s != end && *s == ';')
     {
-      /*i
+      name = p;
+      esc_len = s - p;
+      X->loc.col_no += esc_len + 1;
+    }
+  else
+    for(name = esc, esc_len = 0; ';' != (c = _getc(X)); )
+      {
+	/*i
 When escape length exsceeds it's allowed limit the appropriate error
 message is printed.
-       */
-      if (esc_len == max_esc_length)
-	{
-	  fprintf(parser_error_loc(X, &loc),
-		  "%s %u %s\n",
-		  "escape must be shorter", esc_len, "symbols");
-	  break;
-	}
-      /*i
+	 */
+	if (esc_len == max_esc_length)
+	  {
+	    fprintf(parser_error_loc(X, &loc),
+		    "%s %u %s\n",
+		    "escape must be shorter", esc_len, "symbols");
+	    break;
+	  }
+	/*i
 Only alpha-numeric symbols in esapes are allowed.  It is assumed that
 ``;'' is missing when non-alpha-numeric symbol was found before ``;''.
-       */	  
-      if (isalnum(c))
-	esc[esc_len++] = c;
-      else
-	{
-	  fprintf(parser_error_loc(X, &loc),
-		  "%s\n",
-		  "missing \";\" in escape");
-	  break;
-	}
-    }
+	 */	  
+	if (c != -1 && (_char_class[c] & char_alnum))
+	  esc[esc_len++] = c;
+	else
+	  {
+	    fprintf(parser_error_loc(X, &loc),
+		    "%s\n",
+		    "missing \";\" in escape");
+	    break;
+	  }
+      }
   
-  esc[esc_len] = 0;
   if (esc_type == '#')
     {
-  /*i
-For symbol-code escapes, decimal and hexadecimal codes are supported.
-   */
-      char *end;
-      if (esc[0] == 'x')
-	c = strtoul((esc + 1), &end, 16);
-      else 
-	c = strtoul((esc), &end, 10);
       /*i
+For symbol-code escapes, decimal and hexadecimal codes are supported.
 Such escapes must have no non-digit or non-hex symbols.
        */
-      if (*end)
-	fprintf(parser_error_loc(X, &loc),
-		"%s\n",
-		"extra text in escape");
+      unsigned i = 0, base = 10, digit;
+      if (esc_len && name[0] == 'x')
+	{
+	  base = 16;
+	  i = 1;
+	}
+
+      for(code = 0; i != esc_len; ++i)
+	{
+	  digit = (name[i] <= '9') ?
+	    name[i] - '0' : (name[i] | 0x20) - 'a' + 10;
+	  if (digit >= base)
+	    {
+	      fprintf(parser_error_loc(X, &loc),
+		      "%s\n",
+		      "extra text in escape");
+	      code = '?';
+	      break;
+	    }
+	  if (code <= 0x10ffff)
+	    code = code*base + digit;
+	}
+      /*i
+The code must be a Unicode scalar value: not zero, not a surrogate and
+not above @code{0x10FFFF}.
+       */
+      if (code == 0 || code > 0x10ffff ||
+	  (0xd800 <= code && code <= 0xdfff))
+	{
+	  fprintf(parser_error_loc(X, &loc),
+		  "%s\n",
+		  "invalid character code in escape");
+	  code = '?';
+	}
     }
   else
     {
       /*i
-The following symbol-name escapes are recognized:
-
-@itemize
+All HTML 4 named entities and ``apos'' are recognized (see
+@code{xml_entity_code}).  All other names give question mark ``?''
+and appropriate error message is generated.
        */
-      // Cichelli hash
-      const char *esc1;
-      switch(esc_len + esc[0])
-	{
-	  /*i
-@item lt
-gives ``<''
-	   */
-	case 110: esc1 = "<lt"; break;
-	  /*i
-@item gt
-gives ``>''
-	   */
-	case 105: esc1 = ">gt"; break;
-	  /*i
-@item apos
-gives apostrophe
-	   */
-	case 101: esc1 = "'apos"; break;
-	  /*i
-@item quote
-gives quotaion mark
-	   */
-	case 117: esc1 = "\"quot"; break;
-	  /*i
-@item amp
-gives ampersand
-	   */
-	case 100: esc1 = "&amp"; break;
-	  /*i
-@item nbsp
-gives usual space
-	   */
-	case 114: esc1 = " nbsp"; break;
-	  /*i
-@end itemize
-	   */
-	default: esc1 = "?"; break;
-	}
-
-      if (0 == strcmp(esc, (esc1 + 1)))
-	c = esc1[0];
+      c = xml_entity_code(name, esc_len);
+      if (c != -1)
+	code = c;
       else
 	{
-	  /*i
-
-All other symbols gives question mark ``?''.  Appropriate error
-message is generated.
-	   */
-	  ++X->errors;
 	  fprintf(parser_error_loc(X, &loc),
-		  "%s \"&%s;\"\n",
-		  "unknown escape", (esc));
-	  c = '?';
+		  "%s \"&%.*s;\"\n",
+		  "unknown escape", (int)esc_len, (const char *)name);
+	  code = '?';
 	}
     }
-  // TODO: utf-8
-  _add_text(X, c);  
+
+  _add_utf8(X, code);
 }
 
 
@@ -652,14 +2698,16 @@ _do_bind_namesp(struct read_xml_t *X,
 		struct xml_attr_t *attr1, unsigned namesp_token)
 {
   // add bindings
-  if (X->bound_size != max_bound_size)
+  if (X->bound_size != X->limits.bound_size ||
+      _grow_bound(X, X->limits.bound_size + 1))
     {
       struct xml_binding_t *binding1 = X->bound + (X->bound_size++);
       binding1->namesp_token = namesp_token;
       binding1->name_index = X->bound_text_size;
-      unsigned name_size = attr1->val_index - attr1->namesp_index;
+      unsigned name_size = strlen(X->text + attr1->namesp_index) + 1;
       unsigned new_bound_text_size = X->bound_text_size + name_size;
-      if (new_bound_text_size <= max_bound_text_size)
+      if (new_bound_text_size <= X->limits.bound_text_size ||
+	  _grow_bound_text(X, new_bound_text_size))
 	{
 	  memcpy(X->bound_text + X->bound_text_size,
 		 X->text + attr1->namesp_index,
@@ -670,13 +2718,13 @@ _do_bind_namesp(struct read_xml_t *X,
 	fprintf(parser_attr_error(X),
 		"%s %u %s\n",
 		"too much bound text, please set \"max_bound_text_size\" to",
-		(2*max_bound_text_size), "or more");
+		(2*X->limits.bound_text_size), "or more");
     }
   else
     fprintf(parser_attr_error(X),
 	    "%s %u %s\n",
 	    "too much many bindings, please set \"max_bound_size\" to",
-	    (2*max_bound_text_size), "or more");
+	    (2*X->limits.bound_size), "or more");
 }
   
 
@@ -687,6 +2735,7 @@ static void
 _do_open_tag(struct read_xml_t *X)
 {
   struct xml_stack_node_t *top = X->stack + (X->stack_size++);
+  top->loc = X->tag_loc;
   top->id_token = X->attrs[0].id_token;
   top->namesp_token = X->attrs[0].namesp_token;
 }
@@ -715,7 +2764,7 @@ tags.  They are not checked for open/close balance.
 	  X->warned_abount_unknown_tag_balance = true;
 	  if (extra_messages_allowed())
 	    {
-	      fprintf(parser_messg(X->source,
+	      fprintf(_messg(X,
 				   &X->lex_loc,
 				   "warning(once)"),
 		      "%s\n",
@@ -735,7 +2784,7 @@ error message printed.
 		  "closing tag", xml_token_name(X->attrs[0].namesp_token),
 		  xml_token_name(X->attrs[0].id_token),
 		  "mismatches opening tag");
-	  fprintf(parser_messg(X->source, &top->loc, "note"),
+	  fprintf(_messg(X, &top->loc, "note"),
 		  "%s \"%s:%s\" %s\n",
 		  "the opening", xml_token_name(top->namesp_token),
 		  xml_token_name(top->id_token), "was here");
@@ -764,10 +2813,10 @@ diagnostic message is printed.
        */
       if (extra_messages_allowed())
 	{
-	  fprintf(parser_messg(X->source, &X->attrs[0].loc, "warning"),
+	  fprintf(_messg(X, &X->attrs[0].loc, "warning"),
 		  "%s\n",
 		  "no closing tag is needed here");
-	  fprintf(parser_messg(X->source, &X->ending_loc, "note"),
+	  fprintf(_messg(X, &X->ending_loc, "note"),
 		  "%s\n",
 		  "here we are at root");
 	}
@@ -785,13 +2834,39 @@ enum
   {
     lex_id = 256,
     lex_literal,
+    lex_literal_view,
   };
 
+
+/*i
+In views mode a literal with no escapes which ends in the current
+window is not copied, see @code{set_read_xml_views}.
+ */
+static bool
+_literal_view(struct read_xml_t *X)
+{
+  const unsigned char *p = _span_beg(X);
+  const unsigned char *end = _span_end(X);
+  const unsigned char *s;
+
+  for(s = p; s != end && (_char_class[*s] & char_literal); ++s);
+  if (s == end || *s != '"')
+    return false;
+
+  X->loc.col_no += s + 1 - p;
+  X->view.str = (const char *)p;
+  X->view.len = s - p;
+  X->view.hash = X->text_hash = _hash(p, s - p);
+  X->lex_symbol = X->intern_values ?
+    _token_of_view(X, X->view.str, X->view.len, X->view.hash, false) :
+    not_a_token;
+  return true;
+}
+
 static void
 _next_lex(struct read_xml_t *X)
 {
   X->lex_text_index = X->text_size;
-  X->text_hash = 0;
 
   /*i
 The following tag tokens are recognized:
@@ -816,18 +2891,27 @@ Line feed are used for calculating message location.
 
       /*i
 @item <id>
-May contain any non-space non-punctuation characters and dots,
-hypthens and underscores.
+May contain letters, digits, non-ASCII characters and dots, hypthens
+and underscores.
        */
-      for(; (' ' < c) &&
-	    (!ispunct(c) || c == '_' ||
-	     c == '-' || c == '.'); c = _getc(X))
-	_add_text(X, c);
+      for(; c != -1 && (_char_class[c] & char_id); c = _getc(X))
+	{
+	  const unsigned char *p = _span_beg(X);
+	  const unsigned char *end = _span_end(X);
+	  const unsigned char *s;
+
+	  _add_text(X, c);
+	  /*i
+The rest of the identifier inside the current window is taken at once.
+	   */
+	  for(s = p; s != end && (_char_class[*s] & char_id); ++s);
+	  _add_run(X, p, s);
+	}
       
       if (X->lex_text_index != X->text_size)
 	{
 	  _ungetc(X);
-	  _close_text(X);
+	  _close_text(X, true, true);
 	  X->lex_token = lex_id;
 	  return;
 	}
@@ -838,8 +2922,22 @@ characters are allowed inside.
        */
       if (c == '"')
 	{
-	  while ('"' != (c = _getc(X)))
+	  if (X->views && _literal_view(X))
 	    {
+	      X->lex_token = lex_literal_view;
+	      return;
+	    }
+	  for(;;)
+	    {
+	      const unsigned char *p = _span_beg(X);
+	      const unsigned char *end = _span_end(X);
+	      const unsigned char *s;
+
+	      for(s = p; s != end && (_char_class[*s] & char_literal); ++s);
+	      _add_run(X, p, s);
+
+	      if ('"' == (c = _getc(X)))
+		break;
 	      if (' ' <= c || c == '\t')
 		{
 		  /*i
@@ -847,21 +2945,24 @@ The same escaping rules applies as for plain text.
 		   */
 		  if (c == '&')
 		    _read_esc(X);
-		  _add_text(X, c);
+		  else
+		    _add_text(X, c);
 		}
 	      else
 		{
 		  /*
 It is not correct if end-of-file or non-allowed symbol is found inside
-a literal.
+a literal.  A line feed which breaks the literal is still counted.
 		   */
+		  if (c == '\n')
+		    _got_newline(X);
 		  fprintf(parser_error(X),
 			  "%s\n",
 			  "literal not closed");
 		  break;
 		}
 	    }
-	  _close_text(X);
+	  _close_text(X, X->intern_values, false);
 	  X->lex_token = lex_literal;
 	  return;
 	}
@@ -899,7 +3000,12 @@ where:
 @item  <tag-id>
 Full tag id, have the same format as @var{<attr-id>}.
    */
-  while (X->lex_token == lex_id)
+  /*
+The lexer keeps the last token when the input ends, so the loop stops
+on the end of input rather than on the attribute limit, which a
+growable reader does not have.
+   */
+  while (X->lex_token == lex_id && !X->eof && !X->starved)
     {
       struct xml_attr_t *attr1 = X->attrs + X->attrs_size;
       attr1->loc = X->lex_loc;
@@ -942,14 +3048,14 @@ tag.
 If more then maximum allowed @var{<attr>}s specified the parsing is
 aborted.
        */
-      if (X->attrs_size != max_attrs_size)
+      if (X->attrs_size != X->limits.attrs_size || _grow_attrs(X))
 	++X->attrs_size;	  
       else
 	{
 	  fprintf(parser_lex_error(X),
 		  "%s %u %s\n",
 		  "too many attributes, please set \"max_attrs_size\" to",
-		  (2*max_bound_text_size), "or more");
+		  (2*X->limits.attrs_size), "or more");
 	  break;
 	}
     }
@@ -978,6 +3084,7 @@ default one (as if alias was an empty string).
   attr1->id_token = X->lex_symbol;      
   attr1->val_token = attr1->namesp_token = not_a_token;
   attr1->val_index = attr1->namesp_index = X->text_size - 1;
+  attr1->val_view = 0;
   _next_lex(X);
   if (X->lex_token == ':')
     {	  
@@ -1024,10 +3131,30 @@ static void
 _read_attr_val(struct read_xml_t *X,
 	       struct xml_attr_t *attr1)
 {
-  if (X->lex_token == lex_literal)
+  if (X->lex_token == lex_literal || X->lex_token == lex_literal_view)
     {
+      bool view = X->lex_token == lex_literal_view;
       attr1->val_token = X->lex_symbol;
-      attr1->val_index = X->lex_text_index;
+      /*i
+A view literal leaves the value index at the empty string.
+       */
+      if (view)
+	{
+	  attr1->val_view = X->view.str;
+	  attr1->val_view_len = X->view.len;
+	}
+      else
+	attr1->val_index = X->lex_text_index;
+      /*i
+Namespace names are always interned, bindings are made by tokens.  They
+are names, so a value token is not kept for them.
+       */
+      if ((!X->intern_values || X->name_token) &&
+	  X->xmlns != not_a_token && attr1->id_token == X->xmlns)
+	attr1->val_token = view ?
+	  _token_of_view(X, X->view.str, X->view.len, X->text_hash, true) :
+	  _token_of(X, (X->text + X->lex_text_index),
+		    X->text_size - 1 - X->lex_text_index, X->text_hash, true);
       _next_lex(X);
     }
   else
@@ -1061,7 +3188,7 @@ for given alias (optional).
 	       */
 	      if (extra_messages_allowed())
 		{	      
-		  fprintf(parser_messg(X->source,
+		  fprintf(_messg(X,
 				       &a->loc,
 				       "warning"),
 			  "%s \"%s\" %s\n",
@@ -1075,7 +3202,7 @@ during the rest processing.
 	      if (!X->warned_about_unresolved)
 		{
 		  X->warned_about_unresolved = true;
-		  fprintf(parser_messg(X->source,
+		  fprintf(_messg(X,
 				       &a->loc,
 				       "note"),
 			  "%s\n",
@@ -1107,6 +3234,16 @@ FILE*
 parser_messg(const char *source,
 	    struct xml_location_t *loc,
 	    const char *type)
+{
+  return _messg_header(stderr, source, loc, type);
+}
+
+
+static FILE*
+_messg_header(FILE *out,
+	      const char *source,
+	      struct xml_location_t *loc,
+	      const char *type)
 {
   if (loc && loc->line_no)
     {
@@ -1117,7 +3254,7 @@ parser_messg(const char *source,
 
 if location of object related to message is known.
    */
-      fprintf(stderr,
+      fprintf(out,
 	      "%s:%u:%u: %s: ",
 	      source, loc->line_no, loc->col_no,
 	      type);
@@ -1131,11 +3268,49 @@ if location of object related to message is known.
 
 if location of object related to message is unknown.
    */
-      fprintf(stderr,
+      fprintf(out,
 	      "%s: %s: ",
 	      source, type);
     }
-  return stderr;
+  return out;
+}
+
+
+/*i
+Messages of a reader go to stderr.  In push mode they are held back
+until the node they belong to is complete: a node which is cut by the
+end of available input is parsed again later and its messages would
+be wrong.
+ */
+static FILE*
+_messg(struct read_xml_t *X,
+       struct xml_location_t *loc,
+       const char *type)
+{
+  struct xml_location_t where;
+  if (X->lazy_loc && loc)
+    {
+      where = resolve_xml_location(X, loc);
+      loc = &where;
+    }
+
+  if (X->messg == 0)
+    return parser_messg(X->source, loc, type);
+
+  X->messg_pending = true;
+  return _messg_header(X->messg, X->source, loc, type);
+}
+
+
+static void
+_flush_messg(struct read_xml_t *X)
+{
+  long len = ftell(X->messg);
+
+  fflush(X->messg);
+  fwrite(X->messg_buf, 1, len, stderr);
+  rewind(X->messg);
+  X->messg_pending = false;
 }
 
 /*i
@@ -1148,7 +3323,7 @@ parser_error_loc(struct read_xml_t *X, struct xml_location_t *loc)
 Error messages are counted.  Non-zero count indicates parsing failure.
    */
   ++X->errors;
-  return parser_messg(X->source, loc, "error");
+  return _messg(X, loc, "error");
 }
 
 
@@ -1224,7 +3399,7 @@ find_xml_attr(struct read_xml_t *X,
 
       if (extra_messages_allowed())
 	{
-	  fprintf(parser_messg(X->source, &X->attrs[0].loc, "warning"),
+	  fprintf(_messg(X, &X->attrs[0].loc, "warning"),
 		  "%s \"%s:%s\" %s \"%s:%s\"\n",
 		  "no attribute", xml_token_name(namesp_token),
 		  xml_token_name(id_token),
@@ -1236,7 +3411,7 @@ find_xml_attr(struct read_xml_t *X,
     {
       if (extra_messages_allowed())
 	{
-	  fprintf(parser_messg(X->source, &X->lex_loc, "warning"),
+	  fprintf(_messg(X, &X->lex_loc, "warning"),
 		  "%s \"%s:%s\"\n",
 		  "here should be a tag with attribute",
 		  xml_token_name(namesp_token),
@@ -1256,7 +3431,7 @@ find_xml_tag_recursive(struct read_xml_t *X,
 
   loc_start = X->tag_loc;
   
-  while (!X->eof && min_level <= X->stack_size)
+  while (!X->eof && !X->starved && min_level <= X->stack_size)
     {
       enum xml_node_type_t node_type;
       node_type = bump_xml_node(X);
@@ -1268,13 +3443,13 @@ find_xml_tag_recursive(struct read_xml_t *X,
 	}		
     }
 
-  if (extra_messages_allowed())
+  if (!X->starved && extra_messages_allowed())
     {
-      fprintf(parser_messg(X->source, &loc_start, "warning"),
+      fprintf(_messg(X, &loc_start, "warning"),
 	      "%s \"%s:%s\" %s\n",
 	      "no tag", xml_token_name(namesp_token),
 	      xml_token_name(id_token), "found");
-      fprintf(parser_messg(X->source, &X->tag_loc, "note"),
+      fprintf(_messg(X, &X->tag_loc, "note"),
 	      "%s\n",
 	      "up to here");
     }
@@ -1286,7 +3461,7 @@ find_xml_tag_recursive(struct read_xml_t *X,
 struct xml_attr_t*
 bump_xml_tag_at(struct read_xml_t *X, unsigned level)
 {
-  while (!X->eof && level <= X->stack_size)
+  while (!X->eof && !X->starved && level <= X->stack_size)
     {
       ignore_rest_xml_at(X, level + 1);
       if (bump_xml_node(X) <= xml_node_text)
@@ -1320,7 +3495,7 @@ void
 ignore_rest_xml_at(struct read_xml_t *X, unsigned level)
 {
   unsigned max_level = X->stack_size;
-  while (!X->eof && level <= X->stack_size)
+  while (!X->eof && !X->starved && level <= X->stack_size)
     {
       if (bump_xml_node(X) <= xml_node_text &&
 	  X->stack_size <= max_level)
@@ -1329,7 +3504,7 @@ ignore_rest_xml_at(struct read_xml_t *X, unsigned level)
 
 	  if (extra_messages_allowed())
 	    {
-	      fprintf(parser_messg(X->source, &X->attrs[0].loc, "warning"),
+	      fprintf(_messg(X, &X->attrs[0].loc, "warning"),
 		      "<%s:%s> %s\n",
 		      (X->text + X->attrs[0].namesp_index),
 		      (X->text + X->attrs[0].id_index), "is skipped");
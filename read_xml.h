@@ -3,13 +3,27 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stddef.h>
 
 /**
-Data type to hold token id.  Please adjust also `not_a_token' to some
-value inside `xml_token_t' value range.
+Data type to hold token id.  Its width is chosen at build time by
+defining @code{XML_TOKEN_BITS} to 16 (the default, up to 65535 tokens)
+or 32 (up to 4294967295 tokens), the same for the library and its
+users.  @code{not_a_token} is the largest value of the type.
  */
+#ifndef XML_TOKEN_BITS
+#define XML_TOKEN_BITS 16
+#endif
+
+#if XML_TOKEN_BITS == 16
 typedef short unsigned
 xml_token_t;
+#elif XML_TOKEN_BITS == 32
+typedef unsigned
+xml_token_t;
+#else
+#error "XML_TOKEN_BITS must be 16 or 32"
+#endif
 
 /**
 User-defined function which is called before printing every optional
@@ -23,6 +37,31 @@ extern int
 extra_messages_allowed();
 
 
+/**
+Hash algorithms.  The algorithm is chosen at build time by defining
+@code{XML_HASH} to one of them, the same for the library and its
+users:
+
+@table @code
+@item XML_HASH_33
+hash(0, str) = 0, hash(i + 1, str) = 33 * hash(i, str) + str[i]
+(the default, compatible with older token tables);
+@item XML_HASH_FNV1A
+32-bit FNV-1a, one byte per step;
+@item XML_HASH_WORD
+8 bytes per step with 64-bit multiply-xorshift mixing.  Its values
+depend on byte order.
+@end table
+ */
+#define XML_HASH_33 1
+#define XML_HASH_FNV1A 2
+#define XML_HASH_WORD 3
+
+#ifndef XML_HASH
+#define XML_HASH XML_HASH_33
+#endif
+
+
 /**
 User-defined function to calculate uniqual string ID.  Optional hash
 may be given.
@@ -34,15 +73,9 @@ may be given.
 The same strings should give same IDs.  Different strings should give
 different IDs.
 
-If the hash is not given (zero) it should be calculated with the
-following algorithm:
-
-@code
-hash(0, str) = 0
-hash(i + 1, str) = 33 * hash(i, str) + str[i]
-@literal
-
-This algorithm is used by the XML read itself.
+If the hash is not given (zero) it should be calculated with
+@code{string_hash}, which applies the algorithm chosen by
+@code{XML_HASH}.  The XML reader passes hashes of the same algorithm.
 The hash may be not calculated if it is not used.
  */
 extern xml_token_t
@@ -51,6 +84,9 @@ xml_token_by_name(const char *str, unsigned opt_hash);
 unsigned
 string_hash(const char *str);
 
+unsigned
+xml_hash(const char *data, unsigned len);
+
 
 /**
 User-defined function to get string by it's ID.  
@@ -59,6 +95,23 @@ It is used for diagnostic messages.
 extern const char*
 xml_token_name(xml_token_t token);
 
+/*i
+Optional recognizer of names known in advance, see
+@code{set_read_xml_known_tokens}.  It gets a name with its length and
+hash and returns its token, or @code{not_a_token} when it does not know
+the name.
+ */
+typedef xml_token_t
+xml_known_token_t(const char *str, unsigned len, unsigned hash);
+
+/*i
+Optional interner of names, see @code{set_read_xml_name_tokens}.  It
+takes the same arguments as @code{xml_token_by_name} and must give the
+same tokens.
+ */
+typedef xml_token_t
+xml_name_token_t(const char *str, unsigned opt_hash);
+
 /*i
 @chapter Parser limitations
 
@@ -131,28 +184,70 @@ null characters per active bindings for each node is allowed.
 
     /*i
 @item XML document is processed by blocks of 1024 bytes.  Actually
-this is rather setting then limitation.
+this is rather setting then limitation.  A larger buffer can be given
+at run time.
      */
     io_buf_size = 1024,
 
     /*i
-@item Maximum 65535 different tokens may be recognized.  This includes
-XML keywords, tag names, attribute names and values, XML text values.
-A document of more different token count may be processed but fast
-compare feature cannot use more tokens.
+@item In-memory input (for example a mapped file) is served by windows
+of at most 1 GiB, so column arithmetic never overflows.
      */
-    not_a_token = 65535,
+    mem_window_size = 1 << 30,
+
 /*i
+@item Maximum 65535 different tokens may be recognized (4294967295
+with 32-bit tokens).  This includes XML keywords, tag names, attribute
+names and values, XML text values.  A document of more different token
+count may be processed but fast compare feature cannot use more tokens.
 @end itemize
+
+The value is kept apart from the other limits, so a 32-bit one does not
+make them unsigned.
  */
   };
 
+enum
+  {
+    not_a_token = (xml_token_t)-1,
+  };
+
+
+/*i
+@section Limits of a reader
+
+The attribute, binding, depth and text limits above are the defaults of
+a reader, the storage for them is a part of the reader and is taken by
+every init function.  A reader may be given other limits, with storage
+of its own, by @code{set_read_xml_limits} (in C++ by
+@code{basic_read_xml}), and may be let to grow its buffers on the heap
+by @code{set_read_xml_growable}.  No limit may be more than 65535, the
+range of the size counters.
+ */
+struct xml_limits_t
+{
+  short unsigned attrs_size;
+  short unsigned bound_size;
+  short unsigned stack_size;
+  short unsigned text_size;
+  short unsigned bound_text_size;
+};
+
 
+/*i
+Text over the text buffer comes by pieces as
+@code{xml_node_text_chunk} when the reader is set to, see
+@code{set_read_xml_text_chunks}.  CDATA sections come as
+@code{xml_node_cdata}.
+ */
 enum xml_node_type_t
   {
     xml_node_open,
     xml_node_text,
     xml_node_close,
+    xml_node_need_more,
+    xml_node_text_chunk,
+    xml_node_cdata,
   };    
 
 
@@ -160,6 +255,9 @@ enum xml_read_state_t
   {
     xml_read__text,
     xml_read__end_of_tag,
+    xml_read__chunk_space,
+    xml_read__chunk_word,
+    xml_read__cdata,
   };
 
 /*i
@@ -184,6 +282,12 @@ struct xml_location_t
 @end itemize
 
 Note: some limitation applies to their values.
+
+In lazy mode (see @code{set_read_xml_lazy_locations}) a location keeps
+the byte offset from the document start in @var{col_no} and zero in
+@var{line_no}.  @code{resolve_xml_location} turns it into line and
+column numbers.  With @code{XML_NO_LOCATIONS} defined at build time no
+locations are tracked at all and messages have no location.
  */
 
 
@@ -203,6 +307,37 @@ struct xml_attr_t
   xml_token_t namesp_token;
   xml_token_t id_token;
   xml_token_t val_token;
+  /*i
+@item value in the input
+Set when the value is not copied, see @code{set_read_xml_views}, and
+zero otherwise.
+   */
+  unsigned val_view_len;
+  const char *val_view;
+};
+
+
+/*i
+A text or attribute value as read: null-terminated, with its length
+and hash.
+ */
+struct xml_value_t
+{
+  const char *str;
+  unsigned len;
+  unsigned hash;
+};
+
+
+/*i
+A part of the input as it is, not null-terminated.  It is valid until
+the next node is read.
+ */
+struct xml_view_t
+{
+  const char *str;
+  unsigned len;
+  unsigned hash;
 };
 
 
@@ -223,53 +358,205 @@ struct xml_stack_node_t
 };
 
 
-struct read_xml_t
+/*i
+In push mode the parser state is saved at every node start.  When the
+input ends inside a node the parser returns to this mark.
+ */
+struct xml_read_mark_t
 {
-  const char *source;
+  const unsigned char *ptr;
   struct xml_location_t loc;
   struct xml_location_t lex_loc;
   struct xml_location_t tag_loc;
   struct xml_location_t ending_loc;
- 
+
+  unsigned errors;
+
+  short int lex_token;
+  short unsigned attrs_size;
+  short unsigned stack_size;
+  short unsigned bound_size;
+  short unsigned text_size;
+  short unsigned bound_text_size;
+
+  enum xml_read_state_t state;
+
+  bool in_carry;
+  bool warned_about_max_line_no;
+  bool warned_about_max_col_no;
+  bool warned_about_unresolved;
+  bool warned_abount_unknown_tag_balance;
+};
+
+
+/*i
+Optional read-ahead: a helper thread fills one half of a buffer while
+the parser consumes the other one.  Its state is private to the reader,
+so users of this header need no thread types.
+ */
+struct xml_read_ahead_t;
+
+
+/*i
+Storage of a reader for the default limits, with an I/O buffer of the
+default size.
+ */
+struct read_xml_fixed_t
+{
   struct xml_attr_t attrs[1 + max_attrs_size];
   struct xml_stack_node_t stack[max_stack_size];
   struct xml_binding_t bound[max_bound_size];
+  char text[max_text_size];
+  char bound_text[max_bound_text_size];
+  unsigned char io_buf[io_buf_size];
+};
 
-  unsigned char *line_start;
 
-  int io;
+/*i
+The buffers given to a reader, its own ones by the init functions or
+others by @code{set_read_xml_limits}.  A grown buffer is freed and the
+given one is taken back by @code{done_read_xml}.
+ */
+struct xml_storage_t
+{
+  struct xml_limits_t limits;
+  struct xml_attr_t *attrs;
+  struct xml_stack_node_t *stack;
+  struct xml_binding_t *bound;
+  char *text;
+  char *bound_text;
+};
 
-  unsigned text_hash;
-  unsigned errors;
+
+/*i
+The fields are ordered by how often they are used.  The state touched
+for every byte (the cursor, the window edges and the text being
+collected) comes first and fits one cache line, the per token state
+follows in the next one; the per document and per reader state and the
+buffers come last.  With many readers in turn only their first two
+lines compete for the cache.
+ */
+struct read_xml_t
+{
+  const unsigned char *line_start;
+  struct xml_location_t loc;
   unsigned beg_col_no;
   unsigned end_col_no;
-  
 
+  char *text;
+  unsigned text_hash;
+  struct xml_limits_t limits;
+  short unsigned text_size;
+  short unsigned lex_text_index;
   short int lex_token;
   xml_token_t lex_symbol;
-  short unsigned lex_text_index;
-  
+
+  bool lazy_loc;
+  bool push;
+  bool starved;
+  bool eof;
+
+
+  struct xml_attr_t *attrs;
+  struct xml_stack_node_t *stack;
+  struct xml_binding_t *bound;
+  char *bound_text;
   short unsigned attrs_size;
   short unsigned stack_size;  
   short unsigned bound_size;
-  short unsigned text_size;
   short unsigned bound_text_size;
-  
-  xml_token_t xmlns;
+
+  struct xml_location_t lex_loc;
+  struct xml_location_t tag_loc;
 
   enum xml_read_state_t state;
-  
-  char text[max_text_size];
-  char bound_text[max_bound_text_size];
+  xml_token_t xmlns;
+  xml_known_token_t *known_token;
+  xml_name_token_t *name_token;
+  bool intern_values;
+  bool text_chunks;
+  bool views;
+  bool grow;
+
+  const unsigned char *in_next;
+  size_t in_left;
+
+
+  const char *source;
+  struct xml_location_t ending_loc;
+  struct xml_view_t view;
+
+  int io;
+  unsigned char *io_mem;
+  unsigned io_mem_size;
+  struct xml_read_ahead_t *ahead;
+  struct xml_storage_t given;
+
+  void *map_addr;
+  size_t map_size;
+
+  const char *feed_data;
+  size_t feed_size;
+  unsigned carry_size;
+  struct xml_read_mark_t mark;
+
+  FILE *messg;
+  char *messg_buf;
+  size_t messg_size;
+
+  unsigned lazy_line_no;
+  unsigned lazy_line_off;
+  unsigned lazy_off;
+
+  unsigned errors;
 
   bool warned_about_max_line_no;
   bool warned_about_max_col_no;
   bool warned_about_unresolved;
   bool warned_abount_unknown_tag_balance;
   bool want_warn_end_of_tag;
-  bool eof;
+  bool last_chunk;
 
-  unsigned char io_buf[io_buf_size];
+  bool push_end;
+  bool in_carry;
+  bool messg_pending;
+  unsigned char grown;
+  unsigned char cdata_held;
+
+  struct read_xml_fixed_t fixed;
+};
+
+
+/*i
+A parked reader (see @code{park_read_xml}): the fields of the reader
+before its storage, the open tag, and the open tags, bindings, bound text and unread
+buffered input in @var{data}, in this order.
+ */
+struct xml_parked_t
+{
+  struct xml_attr_t tag;
+  short unsigned stack_size;
+  short unsigned bound_size;
+  short unsigned bound_text_size;
+  unsigned window;
+  bool in_buf;
+  unsigned char core[offsetof(struct read_xml_t, fixed)];
+  unsigned char data[];
+};
+
+
+/*i
+Readers lent to streams being parsed, see @code{borrow_xml_reader}.
+The lock is private to the pool.
+ */
+struct xml_pool_lock_t;
+
+struct xml_reader_pool_t
+{
+  struct xml_pool_lock_t *lock;
+  struct read_xml_t **free;
+  unsigned free_size;
+  unsigned free_capacity;
 };
 
 
@@ -293,6 +580,103 @@ void
 init_read_xml(struct read_xml_t *X,
 	      int io, const char *name);
 
+void
+set_read_xml_buffer(struct read_xml_t *X, void *buf, unsigned size);
+
+bool
+start_read_xml_ahead(struct read_xml_t *X, void *buf, unsigned size);
+
+bool
+init_read_xml_mmap(struct read_xml_t *X,
+		   int io, const char *name);
+
+void
+init_read_xml_mem(struct read_xml_t *X,
+		  const char *data, size_t len, const char *name);
+
+void
+reset_read_xml_mem(struct read_xml_t *X,
+		   const char *data, size_t len, const char *name);
+
+void
+init_read_xml_push(struct read_xml_t *X, const char *name);
+
+void
+xml_feed(struct read_xml_t *X, const char *data, size_t len);
+
+bool
+set_read_xml_lazy_locations(struct read_xml_t *X);
+
+void
+set_read_xml_known_tokens(struct read_xml_t *X, xml_known_token_t *known);
+
+void
+set_read_xml_name_tokens(struct read_xml_t *X, xml_name_token_t *names);
+
+void
+set_read_xml_intern_values(struct read_xml_t *X, bool intern);
+
+void
+set_read_xml_text_chunks(struct read_xml_t *X, bool chunks);
+
+void
+set_read_xml_limits(struct read_xml_t *X, const struct xml_limits_t *limits,
+		    struct xml_attr_t *attrs, struct xml_stack_node_t *stack,
+		    struct xml_binding_t *bound,
+		    char *text, char *bound_text);
+
+void
+set_read_xml_growable(struct read_xml_t *X);
+
+bool
+set_read_xml_views(struct read_xml_t *X, bool views);
+
+struct xml_value_t
+xml_text_value(struct read_xml_t *X);
+
+struct xml_value_t
+xml_attr_value(struct read_xml_t *X, const struct xml_attr_t *attr);
+
+struct xml_view_t
+xml_text_view(struct read_xml_t *X);
+
+struct xml_view_t
+xml_attr_view(struct read_xml_t *X, const struct xml_attr_t *attr);
+
+xml_token_t
+intern_xml_text(struct read_xml_t *X);
+
+xml_token_t
+intern_xml_attr_value(struct read_xml_t *X, struct xml_attr_t *attr);
+
+struct xml_location_t
+resolve_xml_location(struct read_xml_t *X,
+		     const struct xml_location_t *loc);
+
+void
+done_read_xml(struct read_xml_t *X);
+
+struct xml_parked_t *
+park_read_xml(struct read_xml_t *X);
+
+bool
+unpark_read_xml(struct read_xml_t *X, struct xml_parked_t *P);
+
+void
+done_parked_xml(struct xml_parked_t *P);
+
+bool
+init_xml_reader_pool(struct xml_reader_pool_t *pool);
+
+void
+done_xml_reader_pool(struct xml_reader_pool_t *pool);
+
+struct read_xml_t *
+borrow_xml_reader(struct xml_reader_pool_t *pool);
+
+void
+return_xml_reader(struct xml_reader_pool_t *pool, struct read_xml_t *X);
+
 enum xml_node_type_t
 bump_xml_node(struct read_xml_t *X);
 
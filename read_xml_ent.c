@@ -0,0 +1,316 @@
+#include "read_xml_ent.h"
+#include <string.h>
+
+/*i
+@chapter Named character references
+
+All HTML 4 entities and ``apos'' are recognized.  Note: ``nbsp''
+gives usual space as it always did.
+
+The table is addressed by a perfect hash: the 33-hash of the name
+(the same as the reader uses for text) is mixed with a seed, its top
+bits select a displacement and the displaced value is the slot.  Each
+slot holds at most one name, so a lookup is one hash and one compare.
+The table was generated for the seed below; changing the set of names
+needs a new seed and new displacements.
+ */
+enum
+  {
+    entity_seed = 4,
+    entity_bucket_bits = 7,
+    entity_slots = 512,
+  };
+
+struct _entity_t
+{
+  char name[9];
+  unsigned short code;
+};
+
+static const unsigned short _disp[1 << entity_bucket_bits] =
+  {
+    0, 1, 0, 0, 1, 0, 0, 1, 1, 0, 1, 0, 0, 0, 2, 0, 0, 0, 1, 0, 1, 0, 1,
+    17, 0, 0, 0, 0, 0, 1, 0, 0, 0, 0, 2, 0, 1, 0, 1, 1, 0, 3, 7, 0, 0,
+    0, 0, 2, 0, 1, 5, 0, 0, 0, 0, 0, 0, 0, 0, 0, 4, 1, 3, 0, 6, 3, 0, 0,
+    1, 0, 0, 0, 0, 0, 1, 2, 0, 0, 2, 0, 0, 3, 6, 4, 1, 0, 1, 0, 0, 1, 1,
+    0, 2, 0, 1, 0, 0, 0, 2, 0, 1, 3, 1, 0, 0, 0, 0, 1, 4, 0, 0, 1, 0, 0,
+    0, 4, 14, 0, 4, 1, 1, 0, 5, 0, 0, 1, 0, 1,
+  };
+
+static const struct _entity_t _entities[entity_slots] =
+  {
+    [3] = {"scaron", 353},
+    [4] = {"iuml", 239},
+    [5] = {"lArr", 8656},
+    [7] = {"and", 8743},
+    [10] = {"ndash", 8211},
+    [14] = {"Oslash", 216},
+    [15] = {"gt", 62},
+    [16] = {"shy", 173},
+    [17] = {"tau", 964},
+    [18] = {"Zeta", 918},
+    [19] = {"uacute", 250},
+    [20] = {"Upsilon", 933},
+    [21] = {"dagger", 8224},
+    [22] = {"tilde", 732},
+    [23] = {"frac34", 190},
+    [27] = {"lfloor", 8970},
+    [29] = {"permil", 8240},
+    [34] = {"pound", 163},
+    [35] = {"para", 182},
+    [36] = {"oline", 8254},
+    [37] = {"not", 172},
+    [38] = {"Acirc", 194},
+    [39] = {"oplus", 8853},
+    [40] = {"larr", 8592},
+    [42] = {"diams", 9830},
+    [46] = {"upsilon", 965},
+    [47] = {"oslash", 248},
+    [49] = {"zeta", 950},
+    [50] = {"ldquo", 8220},
+    [53] = {"Xi", 926},
+    [55] = {"Uuml", 220},
+    [57] = {"hArr", 8660},
+    [58] = {"reg", 174},
+    [67] = {"part", 8706},
+    [68] = {"Omicron", 927},
+    [70] = {"lang", 9001},
+    [71] = {"acirc", 226},
+    [73] = {"supe", 8839},
+    [75] = {"Ouml", 214},
+    [78] = {"sub", 8834},
+    [85] = {"xi", 958},
+    [87] = {"Nu", 925},
+    [88] = {"image", 8465},
+    [89] = {"Iota", 921},
+    [90] = {"harr", 8596},
+    [91] = {"uuml", 252},
+    [94] = {"sdot", 8901},
+    [95] = {"Omega", 937},
+    [99] = {"omicron", 959},
+    [102] = {"AElig", 198},
+    [105] = {"ouml", 246},
+    [107] = {"plusmn", 177},
+    [110] = {"Ugrave", 217},
+    [114] = {"Ucirc", 219},
+    [115] = {"hearts", 9829},
+    [117] = {"frac14", 188},
+    [119] = {"nu", 957},
+    [120] = {"Beta", 914},
+    [121] = {"iota", 953},
+    [122] = {"hellip", 8230},
+    [124] = {"Gamma", 915},
+    [125] = {"upsih", 978},
+    [126] = {"omega", 969},
+    [127] = {"thorn", 254},
+    [134] = {"Mu", 924},
+    [141] = {"clubs", 9827},
+    [143] = {"ugrave", 249},
+    [144] = {"iquest", 191},
+    [146] = {"ucirc", 251},
+    [147] = {"Agrave", 192},
+    [149] = {"deg", 176},
+    [150] = {"Phi", 934},
+    [151] = {"gamma", 947},
+    [152] = {"beta", 946},
+    [153] = {"Lambda", 923},
+    [154] = {"acute", 180},
+    [155] = {"empty", 8709},
+    [157] = {"Rho", 929},
+    [158] = {"uArr", 8657},
+    [161] = {"int", 8747},
+    [163] = {"ni", 8715},
+    [164] = {"rlm", 8207},
+    [165] = {"Aring", 197},
+    [166] = {"prop", 8733},
+    [167] = {"nbsp", 32},
+    [168] = {"aelig", 230},
+    [169] = {"Atilde", 195},
+    [170] = {"mu", 956},
+    [171] = {"otimes", 8855},
+    [172] = {"rang", 9002},
+    [174] = {"raquo", 187},
+    [178] = {"agrave", 224},
+    [180] = {"thinsp", 8201},
+    [181] = {"phi", 966},
+    [184] = {"lambda", 955},
+    [190] = {"uarr", 8593},
+    [191] = {"rho", 961},
+    [192] = {"Yacute", 221},
+    [193] = {"prod", 8719},
+    [196] = {"Ntilde", 209},
+    [197] = {"aring", 229},
+    [200] = {"atilde", 227},
+    [201] = {"Prime", 8243},
+    [203] = {"apos", 39},
+    [212] = {"Ocirc", 212},
+    [219] = {"thetasym", 977},
+    [220] = {"sube", 8838},
+    [224] = {"rdquo", 8221},
+    [225] = {"yacute", 253},
+    [226] = {"loz", 9674},
+    [227] = {"sigmaf", 962},
+    [228] = {"ntilde", 241},
+    [230] = {"rArr", 8658},
+    [231] = {"Eacute", 201},
+    [233] = {"prime", 8242},
+    [237] = {"cup", 8746},
+    [238] = {"Delta", 916},
+    [239] = {"rsaquo", 8250},
+    [240] = {"copy", 169},
+    [241] = {"sbquo", 8218},
+    [245] = {"ocirc", 244},
+    [246] = {"Yuml", 376},
+    [247] = {"macr", 175},
+    [249] = {"Kappa", 922},
+    [250] = {"amp", 38},
+    [251] = {"piv", 982},
+    [253] = {"zwnj", 8204},
+    [254] = {"sect", 167},
+    [255] = {"Epsilon", 917},
+    [256] = {"Ograve", 210},
+    [259] = {"rarr", 8594},
+    [260] = {"forall", 8704},
+    [262] = {"eacute", 233},
+    [265] = {"Psi", 936},
+    [270] = {"delta", 948},
+    [271] = {"zwj", 8205},
+    [272] = {"equiv", 8801},
+    [273] = {"cap", 8745},
+    [274] = {"Theta", 920},
+    [275] = {"yuml", 255},
+    [276] = {"OElig", 338},
+    [277] = {"ETH", 208},
+    [278] = {"Otilde", 213},
+    [280] = {"uml", 168},
+    [282] = {"Igrave", 204},
+    [283] = {"kappa", 954},
+    [284] = {"rceil", 8969},
+    [285] = {"sim", 8764},
+    [286] = {"epsilon", 949},
+    [288] = {"ograve", 242},
+    [289] = {"divide", 247},
+    [292] = {"spades", 9824},
+    [293] = {"lt", 60},
+    [295] = {"Euml", 203},
+    [296] = {"Aacute", 193},
+    [297] = {"psi", 968},
+    [299] = {"brvbar", 166},
+    [300] = {"notin", 8713},
+    [302] = {"ge", 8805},
+    [304] = {"lsquo", 8216},
+    [306] = {"theta", 952},
+    [309] = {"otilde", 245},
+    [310] = {"or", 8744},
+    [314] = {"nabla", 8711},
+    [315] = {"igrave", 236},
+    [317] = {"fnof", 402},
+    [318] = {"quot", 34},
+    [319] = {"sup3", 179},
+    [322] = {"Alpha", 913},
+    [323] = {"perp", 8869},
+    [326] = {"alefsym", 8501},
+    [327] = {"euml", 235},
+    [328] = {"aacute", 225},
+    [329] = {"there4", 8756},
+    [334] = {"asymp", 8776},
+    [339] = {"cong", 8773},
+    [340] = {"trade", 8482},
+    [341] = {"oelig", 339},
+    [344] = {"radic", 8730},
+    [347] = {"curren", 164},
+    [349] = {"Auml", 196},
+    [350] = {"Egrave", 200},
+    [353] = {"sum", 8721},
+    [354] = {"alpha", 945},
+    [355] = {"Ecirc", 202},
+    [359] = {"ne", 8800},
+    [366] = {"cent", 162},
+    [368] = {"euro", 8364},
+    [370] = {"infin", 8734},
+    [373] = {"eth", 240},
+    [375] = {"ordm", 186},
+    [377] = {"exist", 8707},
+    [380] = {"auml", 228},
+    [381] = {"dArr", 8659},
+    [382] = {"Eta", 919},
+    [383] = {"egrave", 232},
+    [384] = {"szlig", 223},
+    [385] = {"iexcl", 161},
+    [386] = {"ecirc", 234},
+    [387] = {"crarr", 8629},
+    [388] = {"lceil", 8968},
+    [389] = {"lsaquo", 8249},
+    [390] = {"laquo", 171},
+    [391] = {"times", 215},
+    [395] = {"frac12", 189},
+    [396] = {"lowast", 8727},
+    [398] = {"sup2", 178},
+    [402] = {"ang", 8736},
+    [405] = {"Oacute", 211},
+    [412] = {"nsub", 8836},
+    [413] = {"darr", 8595},
+    [414] = {"eta", 951},
+    [415] = {"micro", 181},
+    [416] = {"Ccedil", 199},
+    [417] = {"ordf", 170},
+    [421] = {"Sigma", 931},
+    [424] = {"yen", 165},
+    [425] = {"minus", 8722},
+    [429] = {"Pi", 928},
+    [430] = {"Icirc", 206},
+    [432] = {"Iacute", 205},
+    [437] = {"circ", 710},
+    [438] = {"oacute", 243},
+    [444] = {"bull", 8226},
+    [445] = {"frasl", 8260},
+    [448] = {"ccedil", 231},
+    [449] = {"real", 8476},
+    [453] = {"le", 8804},
+    [454] = {"sigma", 963},
+    [455] = {"isin", 8712},
+    [456] = {"weierp", 8472},
+    [461] = {"pi", 960},
+    [462] = {"icirc", 238},
+    [463] = {"iacute", 237},
+    [464] = {"Chi", 935},
+    [467] = {"bdquo", 8222},
+    [472] = {"ensp", 8194},
+    [474] = {"mdash", 8212},
+    [477] = {"sup1", 185},
+    [478] = {"rsquo", 8217},
+    [479] = {"lrm", 8206},
+    [480] = {"THORN", 222},
+    [481] = {"emsp", 8195},
+    [482] = {"Scaron", 352},
+    [483] = {"Iuml", 207},
+    [494] = {"Dagger", 8225},
+    [495] = {"Tau", 932},
+    [496] = {"chi", 967},
+    [497] = {"rfloor", 8971},
+    [500] = {"Uacute", 218},
+    [501] = {"middot", 183},
+    [504] = {"cedil", 184},
+    [508] = {"sup", 8835},
+  };
+
+
+int
+xml_entity_code(const unsigned char *name, unsigned len)
+{
+  const struct _entity_t *e;
+  unsigned h = 0, i;
+
+  if (len == 0 || len >= sizeof(e->name))
+    return -1;
+
+  for(i = 0; i != len; ++i)
+    h = 33*h + name[i];
+  h = (h ^ entity_seed) * 0x9e3779b1u;
+
+  e = _entities + ((h + _disp[h >> (32 - entity_bucket_bits)]) &
+		   (entity_slots - 1));
+  if (e->name[len] == 0 && 0 == memcmp(e->name, name, len))
+    return e->code;
+  return -1;
+}
@@ -0,0 +1,11 @@
+#ifndef READ_XML_ENT_H
+#define READ_XML_ENT_H
+
+/*i
+Returns the code point of a named character reference (without ``&''
+and ``;'') or -1 if the name is unknown.
+ */
+int
+xml_entity_code(const unsigned char *name, unsigned len);
+
+#endif /* READ_XML_ENT_H */
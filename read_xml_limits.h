@@ -0,0 +1,159 @@
+#ifndef READ_XML_LIMITS_H
+#define READ_XML_LIMITS_H
+
+extern "C" {
+#include "read_xml.h"
+}
+
+/*i
+@chapter Reader limits in C++
+
+A C++ reader whose limits are chosen at compile time.  The limits are
+given by a class with the members of @code{xml_default_limits_t}; a
+deployment derives from it and overrides the ones it needs:
+
+@example
+struct feed_limits_t : xml_default_limits_t
+@{
+  static constexpr unsigned text_size = 16*1024;
+  static constexpr unsigned stack_size = 64;
+@};
+
+basic_read_xml<feed_limits_t> X;
+X.init_mem(data, len, "feed");
+while (!X.eof)
+  @{
+    bump_xml_node(&X);
+    ...
+  @}
+done_read_xml(&X);
+@end example
+
+The buffers are members of the reader, so it needs no allocation.  A
+reader with the default limits uses the storage of @code{read_xml_t};
+one with other limits has buffers of its own beside it (an
+@var{io_buf_size} of 0 is for in-memory and mapped input only).  With
+@var{Grow} set they are the starting buffers of a growable reader (see
+@code{set_read_xml_growable}): a document over the limits makes them
+grow on the heap instead of failing.  A reader is a
+@code{read_xml_t}, all the reader functions take it.
+ */
+struct xml_default_limits_t
+{
+  static constexpr unsigned attrs_size = max_attrs_size;
+  static constexpr unsigned bound_size = max_bound_size;
+  static constexpr unsigned stack_size = max_stack_size;
+  static constexpr unsigned text_size = max_text_size;
+  static constexpr unsigned bound_text_size = max_bound_text_size;
+  static constexpr unsigned io_buf_size = ::io_buf_size;
+};
+
+
+/*i
+The buffers of a reader whose limits are not the defaults, given to it
+after every init.
+ */
+template<class Limits, bool Own>
+struct xml_limits_storage_t
+{
+  void
+  use(struct read_xml_t *X)
+  {
+    static constexpr struct xml_limits_t limits =
+      {
+	Limits::attrs_size,
+	Limits::bound_size,
+	Limits::stack_size,
+	Limits::text_size,
+	Limits::bound_text_size,
+      };
+    set_read_xml_limits(X, &limits, attrs_, stack_, bound_,
+			text_, bound_text_);
+    set_read_xml_buffer(X, io_buf_, Limits::io_buf_size);
+  }
+
+  struct xml_attr_t attrs_[1 + Limits::attrs_size];
+  struct xml_stack_node_t stack_[Limits::stack_size];
+  struct xml_binding_t bound_[Limits::bound_size];
+  char text_[Limits::text_size];
+  char bound_text_[Limits::bound_text_size];
+  unsigned char io_buf_[Limits::io_buf_size ? Limits::io_buf_size : 1];
+};
+
+template<class Limits>
+struct xml_limits_storage_t<Limits, false>
+{
+  void
+  use(struct read_xml_t *)
+  {
+  }
+};
+
+
+template<class Limits>
+constexpr bool
+xml_own_storage()
+{
+  return !(Limits::attrs_size == max_attrs_size &&
+	   Limits::bound_size == max_bound_size &&
+	   Limits::stack_size == max_stack_size &&
+	   Limits::text_size == max_text_size &&
+	   Limits::bound_text_size == max_bound_text_size &&
+	   Limits::io_buf_size == io_buf_size);
+}
+
+
+template<class Limits = xml_default_limits_t, bool Grow = false>
+struct basic_read_xml :
+  read_xml_t, private xml_limits_storage_t<Limits, xml_own_storage<Limits>()>
+{
+  static_assert(Limits::attrs_size >= 1 && Limits::attrs_size <= 0xffff &&
+		Limits::bound_size >= 1 && Limits::bound_size <= 0xffff &&
+		Limits::stack_size >= 1 && Limits::stack_size <= 0xffff &&
+		Limits::text_size >= 2 && Limits::text_size <= 0xffff &&
+		Limits::bound_text_size >= 1 &&
+		Limits::bound_text_size <= 0xffff,
+		"reader limits must be from 1 (2 for text) to 65535");
+
+  typedef xml_limits_storage_t<Limits, xml_own_storage<Limits>()> storage_t;
+
+  void
+  init(int io, const char *name)
+  {
+    init_read_xml(this, io, name);
+    _use_storage();
+  }
+
+  bool
+  init_mmap(int io, const char *name)
+  {
+    bool mapped = init_read_xml_mmap(this, io, name);
+    _use_storage();
+    return mapped;
+  }
+
+  void
+  init_mem(const char *data, size_t len, const char *name)
+  {
+    init_read_xml_mem(this, data, len, name);
+    _use_storage();
+  }
+
+  void
+  init_push(const char *name)
+  {
+    init_read_xml_push(this, name);
+    _use_storage();
+  }
+
+private:
+  void
+  _use_storage()
+  {
+    storage_t::use(this);
+    if (Grow)
+      set_read_xml_growable(this);
+  }
+};
+
+#endif /* READ_XML_LIMITS_H */
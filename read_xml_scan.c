@@ -0,0 +1,296 @@
+#include "read_xml_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+/*i
+@section Scalar scanners
+
+They are used on CPUs without vector extensions and for the tails of
+vectorized scans.
+ */
+static const unsigned char *
+_scan_word_scalar(const unsigned char *p, const unsigned char *end)
+{
+  for(; p != end; ++p)
+    if (*p <= ' ' || *p == '<' || *p == '&')
+      break;
+  return p;
+}
+
+
+static const unsigned char *
+_scan_space_scalar(const unsigned char *p, const unsigned char *end)
+{
+  for(; p != end; ++p)
+    if (' ' < *p)
+      break;
+  return p;
+}
+
+
+static const unsigned char *
+_scan_cdata_end_scalar(const unsigned char *p, const unsigned char *end)
+{
+  for(; end - p >= 3; ++p)
+    if (p[0] == ']' && p[1] == ']' && p[2] == '>')
+      return p;
+  return end;
+}
+
+
+static unsigned
+_count_lines_scalar(const unsigned char *p, const unsigned char *end,
+		    const unsigned char **last)
+{
+  unsigned n = 0;
+  for(; p != end; ++p)
+    if (*p == '\n')
+      {
+	++n;
+	*last = p;
+      }
+  return n;
+}
+
+
+#if defined(__SSE2__)
+/*i
+@section SSE2 scanners
+
+16 bytes are classified at once.  Unsigned ``c <= ' ''' is computed as
+``min(c, ' ') == c''.
+ */
+static const unsigned char *
+_scan_word_sse2(const unsigned char *p, const unsigned char *end)
+{
+  const __m128i space = _mm_set1_epi8(' ');
+  const __m128i lt = _mm_set1_epi8('<');
+  const __m128i amp = _mm_set1_epi8('&');
+
+  for(; end - p >= 16; p += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      __m128i m = _mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v),
+			       _mm_or_si128(_mm_cmpeq_epi8(v, lt),
+					    _mm_cmpeq_epi8(v, amp)));
+      unsigned bits = _mm_movemask_epi8(m);
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_word_scalar(p, end);
+}
+
+
+static const unsigned char *
+_scan_space_sse2(const unsigned char *p, const unsigned char *end)
+{
+  const __m128i space = _mm_set1_epi8(' ');
+
+  for(; end - p >= 16; p += 16)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i *)p);
+      unsigned bits = 0xffff &
+	~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_min_epu8(v, space), v));
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_space_scalar(p, end);
+}
+
+
+/*i
+The three bytes of ``]]>'' are compared by three loads shifted by one
+byte, so a match is found at any position.
+ */
+static const unsigned char *
+_scan_cdata_end_sse2(const unsigned char *p, const unsigned char *end)
+{
+  const __m128i rsb = _mm_set1_epi8(']');
+  const __m128i gt = _mm_set1_epi8('>');
+
+  for(; end - p >= 18; p += 16)
+    {
+      __m128i a = _mm_loadu_si128((const __m128i *)p);
+      __m128i b = _mm_loadu_si128((const __m128i *)(p + 1));
+      __m128i c = _mm_loadu_si128((const __m128i *)(p + 2));
+      __m128i m = _mm_and_si128(_mm_cmpeq_epi8(a, rsb),
+				_mm_and_si128(_mm_cmpeq_epi8(b, rsb),
+					      _mm_cmpeq_epi8(c, gt)));
+      unsigned bits = _mm_movemask_epi8(m);
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_cdata_end_scalar(p, end);
+}
+
+
+static unsigned
+_count_lines_sse2(const unsigned char *p, const unsigned char *end,
+		  const unsigned char **last)
+{
+  const __m128i lf = _mm_set1_epi8('\n');
+  unsigned n = 0;
+
+  for(; end - p >= 16; p += 16)
+    {
+      unsigned bits =
+	_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)p),
+					 lf));
+      if (bits)
+	{
+	  n += __builtin_popcount(bits);
+	  *last = p + 31 - __builtin_clz(bits);
+	}
+    }
+  return n + _count_lines_scalar(p, end, last);
+}
+
+
+/*i
+@section AVX2 scanners
+
+The same as SSE2 but 32 bytes at once.
+ */
+__attribute__((target("avx2")))
+static const unsigned char *
+_scan_word_avx2(const unsigned char *p, const unsigned char *end)
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+  const __m256i lt = _mm256_set1_epi8('<');
+  const __m256i amp = _mm256_set1_epi8('&');
+
+  for(; end - p >= 32; p += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)p);
+      __m256i m =
+	_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space), v),
+			_mm256_or_si256(_mm256_cmpeq_epi8(v, lt),
+					_mm256_cmpeq_epi8(v, amp)));
+      unsigned bits = _mm256_movemask_epi8(m);
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_word_sse2(p, end);
+}
+
+
+__attribute__((target("avx2")))
+static const unsigned char *
+_scan_space_avx2(const unsigned char *p, const unsigned char *end)
+{
+  const __m256i space = _mm256_set1_epi8(' ');
+
+  for(; end - p >= 32; p += 32)
+    {
+      __m256i v = _mm256_loadu_si256((const __m256i *)p);
+      unsigned bits =
+	~_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_min_epu8(v, space),
+						 v));
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_space_sse2(p, end);
+}
+
+
+__attribute__((target("avx2")))
+static const unsigned char *
+_scan_cdata_end_avx2(const unsigned char *p, const unsigned char *end)
+{
+  const __m256i rsb = _mm256_set1_epi8(']');
+  const __m256i gt = _mm256_set1_epi8('>');
+
+  for(; end - p >= 34; p += 32)
+    {
+      __m256i a = _mm256_loadu_si256((const __m256i *)p);
+      __m256i b = _mm256_loadu_si256((const __m256i *)(p + 1));
+      __m256i c = _mm256_loadu_si256((const __m256i *)(p + 2));
+      __m256i m = _mm256_and_si256(_mm256_cmpeq_epi8(a, rsb),
+				   _mm256_and_si256(_mm256_cmpeq_epi8(b, rsb),
+						    _mm256_cmpeq_epi8(c, gt)));
+      unsigned bits = _mm256_movemask_epi8(m);
+      if (bits)
+	return p + __builtin_ctz(bits);
+    }
+  return _scan_cdata_end_sse2(p, end);
+}
+
+
+__attribute__((target("avx2")))
+static unsigned
+_count_lines_avx2(const unsigned char *p, const unsigned char *end,
+		  const unsigned char **last)
+{
+  const __m256i lf = _mm256_set1_epi8('\n');
+  unsigned n = 0;
+
+  for(; end - p >= 32; p += 32)
+    {
+      unsigned bits =
+	_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)p),
+					       lf));
+      if (bits)
+	{
+	  n += __builtin_popcount(bits);
+	  *last = p + 31 - __builtin_clz(bits);
+	}
+    }
+  return n + _count_lines_sse2(p, end, last);
+}
+#endif
+
+
+#if defined(__SSE2__)
+const unsigned char *
+(*xml_scan_word)(const unsigned char *, const unsigned char *) =
+  _scan_word_sse2;
+
+const unsigned char *
+(*xml_scan_space)(const unsigned char *, const unsigned char *) =
+  _scan_space_sse2;
+
+const unsigned char *
+(*xml_scan_cdata_end)(const unsigned char *, const unsigned char *) =
+  _scan_cdata_end_sse2;
+
+unsigned
+(*xml_count_lines)(const unsigned char *, const unsigned char *,
+		   const unsigned char **) =
+  _count_lines_sse2;
+
+/*i
+The scanners are chosen once at program start by CPUID.
+ */
+__attribute__((constructor))
+static void
+_choose_scanners(void)
+{
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    {
+      xml_scan_word = _scan_word_avx2;
+      xml_scan_space = _scan_space_avx2;
+      xml_scan_cdata_end = _scan_cdata_end_avx2;
+      xml_count_lines = _count_lines_avx2;
+    }
+}
+#else
+const unsigned char *
+(*xml_scan_word)(const unsigned char *, const unsigned char *) =
+  _scan_word_scalar;
+
+const unsigned char *
+(*xml_scan_space)(const unsigned char *, const unsigned char *) =
+  _scan_space_scalar;
+
+const unsigned char *
+(*xml_scan_cdata_end)(const unsigned char *, const unsigned char *) =
+  _scan_cdata_end_scalar;
+
+unsigned
+(*xml_count_lines)(const unsigned char *, const unsigned char *,
+		   const unsigned char **) =
+  _count_lines_scalar;
+#endif
@@ -0,0 +1,42 @@
+#ifndef READ_XML_SCAN_H
+#define READ_XML_SCAN_H
+
+/*i
+@chapter Byte scanners
+
+The reader scans the current input window by whole runs instead of
+calling @code{_getc} for every byte.  The scanners are vectorized when
+the CPU allows it (SSE2 or AVX2, chosen at run time) and scalar
+otherwise.  Each scanner returns the end of the scanned range if
+nothing is found.
+ */
+
+/*i
+Finds the end of a plain text word: a space or control character,
+``<'' or ``&''.
+ */
+extern const unsigned char *
+(*xml_scan_word)(const unsigned char *p, const unsigned char *end);
+
+/*i
+Finds the end of a space run: the first byte above space.
+ */
+extern const unsigned char *
+(*xml_scan_space)(const unsigned char *p, const unsigned char *end);
+
+/*i
+Finds the end of a CDATA section: the first ``]]>'' which is entirely
+in the range.
+ */
+extern const unsigned char *
+(*xml_scan_cdata_end)(const unsigned char *p, const unsigned char *end);
+
+/*i
+Counts @kbd{LF} bytes in the range.  @var{last} is set to the last
+of them and is left untouched if there are none.
+ */
+extern unsigned
+(*xml_count_lines)(const unsigned char *p, const unsigned char *end,
+		   const unsigned char **last);
+
+#endif /* READ_XML_SCAN_H */
@@ -0,0 +1,1012 @@
+#include "read_xml_tokens.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char snapshot_magic[8] = "xmltok1";
+
+enum
+  {
+    initial_slots = 64,
+    initial_names = 256,
+    first_segment_bits = 8,
+    arena_block_size = 64*1024,
+  };
+
+
+/*i
+The hash given by the reader may be weak in the low bits (for example
+the 33-hash of short names), so it is mixed before it is used.  The
+high bits choose the shard, the low ones the slot.
+ */
+static inline unsigned
+_mix(unsigned hash)
+{
+  hash ^= hash >> 16;
+  hash *= 0x45d9f3bu;
+  hash ^= hash >> 16;
+  return hash;
+}
+
+
+static inline struct xml_token_shard_t *
+_shard_of(struct xml_token_table_t *T, unsigned mixed)
+{
+  return T->shards + (unsigned)(((uint64_t)mixed*xml_token_shards) >> 32);
+}
+
+
+void
+init_xml_token_table(struct xml_token_table_t *T)
+{
+  unsigned i;
+  for(i = 0; i < xml_token_shards; ++i)
+    {
+      pthread_mutex_init(&T->shards[i].lock, 0);
+      T->shards[i].slots = 0;
+      T->shards[i].arena = 0;
+    }
+  for(i = 0; i < xml_token_segments; ++i)
+    T->segments[i] = 0;
+  T->names_size = 0;
+
+  T->base_map = 0;
+  T->base_map_size = 0;
+  T->base_slots = 0;
+  T->base_mask = 0;
+  T->base_size = 0;
+  T->base_names = 0;
+  T->base_strings = 0;
+
+  T->limit = 0;
+  T->values = 0;
+  T->generation = 0;
+  T->clock_hand = 0;
+  T->clock_full = 0;
+  pthread_mutex_init(&T->clock_lock, 0);
+  T->retired = 0;
+  T->retired_size = 0;
+  T->retired_capacity = 0;
+  pthread_mutex_init(&T->free_lock, 0);
+  T->free = 0;
+  T->free_size = 0;
+  T->free_capacity = 0;
+}
+
+
+static struct xml_token_name_t *
+_name(struct xml_token_table_t *T, xml_token_t token);
+
+static struct xml_token_usage_t *
+_usage(struct xml_token_table_t *T, xml_token_t token);
+
+void
+done_xml_token_table(struct xml_token_table_t *T)
+{
+  unsigned i;
+  /*i
+Strings of reclaimed tokens are freed by ID reuse or from the retired
+list, the rest from the directory.
+   */
+  for(i = T->base_size; i < T->names_size; ++i)
+    {
+      struct xml_token_usage_t *usage = _usage(T, i);
+      if (usage && usage->heap)
+	free((void *)_name(T, i)->str);
+    }
+  for(i = 0; i < T->retired_size; ++i)
+    if (_usage(T, T->retired[i].token)->heap)
+      free((void *)T->retired[i].str);
+  free(T->retired);
+  free(T->free);
+  pthread_mutex_destroy(&T->clock_lock);
+  pthread_mutex_destroy(&T->free_lock);
+
+  for(i = 0; i < xml_token_shards; ++i)
+    {
+      struct xml_token_shard_t *shard = T->shards + i;
+      struct xml_token_arena_t *a, *prev_a;
+      struct xml_token_slots_t *s, *prev_s;
+
+      for(a = shard->arena; a; a = prev_a)
+	{
+	  prev_a = a->prev;
+	  free(a);
+	}
+      for(s = shard->slots; s; s = prev_s)
+	{
+	  prev_s = s->retired;
+	  free(s);
+	}
+      pthread_mutex_destroy(&shard->lock);
+    }
+  for(i = 0; i < xml_token_segments; ++i)
+    free(T->segments[i]);
+  if (T->base_map)
+    munmap((void *)T->base_map, T->base_map_size);
+  init_xml_token_table(T);
+}
+
+
+/*i
+@section Names by ID
+
+IDs below @code{base_size} are names of the snapshot, the rest are in
+the directory.
+ */
+static inline struct xml_token_name_t **
+_segment_of(struct xml_token_table_t *T, xml_token_t token, unsigned *index)
+{
+  uint64_t n = (uint64_t)token - T->base_size + (1u << first_segment_bits);
+  unsigned k = 63 - __builtin_clzll(n) - first_segment_bits;
+  *index = (unsigned)(n - ((uint64_t)1 << (k + first_segment_bits)));
+  return T->segments + k;
+}
+
+
+static inline size_t
+_segment_size(struct xml_token_table_t *T, struct xml_token_name_t **segment)
+{
+  return (size_t)1 << (segment - T->segments + first_segment_bits);
+}
+
+
+static struct xml_token_name_t *
+_name(struct xml_token_table_t *T, xml_token_t token)
+{
+  unsigned index;
+  struct xml_token_name_t *s =
+    __atomic_load_n(_segment_of(T, token, &index), __ATOMIC_ACQUIRE);
+  return s ? s + index : 0;
+}
+
+
+static struct xml_token_usage_t *
+_usage(struct xml_token_table_t *T, xml_token_t token)
+{
+  unsigned index;
+  struct xml_token_name_t **segment = _segment_of(T, token, &index);
+  struct xml_token_name_t *s = __atomic_load_n(segment, __ATOMIC_ACQUIRE);
+  return s ? (struct xml_token_usage_t *)(s + _segment_size(T, segment)) +
+    index : 0;
+}
+
+
+/*i
+Takes the next token ID, a reclaimed one when there is any.  The
+segment for a new ID is made before the ID is taken, so a failed
+allocation leaves no gap in the IDs.
+ */
+static xml_token_t
+_next_id(struct xml_token_table_t *T)
+{
+  unsigned n;
+
+  if (__atomic_load_n(&T->free_size, __ATOMIC_RELAXED))
+    {
+      xml_token_t token = not_a_token;
+      pthread_mutex_lock(&T->free_lock);
+      if (T->free_size)
+	{
+	  token = T->free[T->free_size - 1];
+	  __atomic_store_n(&T->free_size, T->free_size - 1, __ATOMIC_RELAXED);
+	}
+      pthread_mutex_unlock(&T->free_lock);
+      if (token != not_a_token)
+	return token;
+    }
+
+  n = __atomic_load_n(&T->names_size, __ATOMIC_RELAXED);
+  for(;;)
+    {
+      struct xml_token_name_t **segment, *s;
+      unsigned index;
+
+      if (n >= not_a_token)
+	return not_a_token;
+
+      segment = _segment_of(T, n, &index);
+      s = __atomic_load_n(segment, __ATOMIC_ACQUIRE);
+      if (s == 0)
+	{
+	  struct xml_token_name_t *expected = 0;
+	  size_t size = _segment_size(T, segment);
+	  if (0 == (s = calloc(size, sizeof(*s) +
+			       sizeof(struct xml_token_usage_t))))
+	    return not_a_token;
+	  if (!__atomic_compare_exchange_n(segment, &expected, s, false,
+					   __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+	    {
+	      free(s);
+	      s = expected;
+	    }
+	}
+
+      if (__atomic_compare_exchange_n(&T->names_size, &n, n + 1, true,
+				      __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	return (xml_token_t)n;
+    }
+}
+
+
+bool
+xml_token_table_name(struct xml_token_table_t *T, xml_token_t token,
+		     struct xml_token_name_t *name)
+{
+  struct xml_token_name_t *s;
+  const char *str;
+
+  if (token < T->base_size)
+    {
+      const struct xml_token_snapshot_name_t *n = T->base_names + token;
+      name->str = T->base_strings + n->offset;
+      name->len = n->len;
+      name->hash = n->hash;
+      return true;
+    }
+
+  if (token >= __atomic_load_n(&T->names_size, __ATOMIC_RELAXED) ||
+      0 == (s = _name(T, token)))
+    return false;
+  /*i
+The string is stored last, a name still being added reads as none.  It
+is cleared when the token is reclaimed.
+   */
+  if (0 == (str = __atomic_load_n(&s->str, __ATOMIC_ACQUIRE)))
+    return false;
+  name->str = str;
+  name->len = s->len;
+  name->hash = s->hash;
+  return true;
+}
+
+
+/*i
+@section Lookup
+
+Lookups run without the shard lock: a slot is written after the name
+it refers to is complete, and is changed only to mark the token
+reclaimed.
+ */
+
+/*i
+With a limit a lookup stamps the token with the current generation.  A
+token being reclaimed at the same time is either kept, as the reclaimer
+sees the stamp, or its string is seen cleared here; then the lookup
+fails and is retried under the shard lock.
+ */
+static bool
+_touch(struct xml_token_table_t *T, xml_token_t token)
+{
+  struct xml_token_usage_t *usage;
+  unsigned generation;
+
+  if (__atomic_load_n(&T->limit, __ATOMIC_RELAXED) == 0)
+    return true;
+
+  generation = __atomic_load_n(&T->generation, __ATOMIC_RELAXED);
+  usage = _usage(T, token);
+  if (__atomic_load_n(&usage->used, __ATOMIC_RELAXED) == generation)
+    return true;
+
+  __atomic_store_n(&usage->used, generation, __ATOMIC_SEQ_CST);
+  return __atomic_load_n(&_name(T, token)->str, __ATOMIC_SEQ_CST) != 0;
+}
+
+
+static xml_token_t
+_find_in(struct xml_token_table_t *T, struct xml_token_slots_t *S,
+	 unsigned mixed, const char *str, unsigned len, unsigned hash)
+{
+  unsigned i;
+  for(i = mixed & S->mask;; i = (i + 1) & S->mask)
+    {
+      uint64_t slot = __atomic_load_n(S->slot + i, __ATOMIC_ACQUIRE);
+      if (slot == 0)
+	return not_a_token;
+      if ((unsigned)slot != 0 && (unsigned)(slot >> 32) == hash)
+	{
+	  xml_token_t token = (xml_token_t)((unsigned)slot - 1);
+	  struct xml_token_name_t name;
+	  if (xml_token_table_name(T, token, &name) &&
+	      name.len == len && 0 == memcmp(name.str, str, len))
+	    return _touch(T, token) ? token : not_a_token;
+	}
+    }
+}
+
+
+static xml_token_t
+_find_in_base(struct xml_token_table_t *T,
+	      unsigned mixed, const char *str, unsigned len, unsigned hash)
+{
+  unsigned i;
+  for(i = mixed & T->base_mask;; i = (i + 1) & T->base_mask)
+    {
+      uint64_t slot = T->base_slots[i];
+      if (slot == 0)
+	return not_a_token;
+      if ((unsigned)(slot >> 32) == hash)
+	{
+	  const struct xml_token_snapshot_name_t *name =
+	    T->base_names + ((unsigned)slot - 1);
+	  if (name->len == len &&
+	      0 == memcmp(T->base_strings + name->offset, str, len))
+	    return (xml_token_t)((unsigned)slot - 1);
+	}
+    }
+}
+
+
+xml_token_t
+find_xml_token(struct xml_token_table_t *T,
+	       const char *str, unsigned len, unsigned hash)
+{
+  unsigned mixed = _mix(hash);
+  struct xml_token_slots_t *S;
+  xml_token_t token;
+
+  if (T->base_slots &&
+      (token = _find_in_base(T, mixed, str, len, hash)) != not_a_token)
+    return token;
+
+  S = __atomic_load_n(&_shard_of(T, mixed)->slots, __ATOMIC_ACQUIRE);
+  return S ? _find_in(T, S, mixed, str, len, hash) : not_a_token;
+}
+
+
+/*i
+@section Insertion
+
+Everything here runs under the shard lock.  A shard is rebuilt when it
+is three quarters full, counting slots of reclaimed tokens: it is
+doubled when more than half of the slots are live, otherwise reclaimed
+slots are just dropped.  The new array is filled before it is
+published.  Stored hashes make rehashing independent of the names.
+ */
+static struct xml_token_slots_t *
+_grow_slots(struct xml_token_table_t *T, struct xml_token_shard_t *shard)
+{
+  struct xml_token_slots_t *old = shard->slots;
+  unsigned live = old ? old->used - old->dead : 0;
+  unsigned size = old == 0 ? initial_slots :
+    (4*(live + 1) > 2*(old->mask + 1)) ? 2*(old->mask + 1) : old->mask + 1;
+  struct xml_token_slots_t *S =
+    calloc(1, sizeof(*S) + size*sizeof(S->slot[0]));
+  unsigned i, j;
+
+  if (S == 0)
+    return 0;
+
+  S->mask = size - 1;
+  if (old)
+    {
+      for(i = 0; i <= old->mask; ++i)
+	if ((unsigned)old->slot[i])
+	  {
+	    for(j = _mix(old->slot[i] >> 32) & S->mask;
+		S->slot[j]; j = (j + 1) & S->mask);
+	    S->slot[j] = old->slot[i];
+	  }
+      S->used = live;
+      old->generation = __atomic_load_n(&T->generation, __ATOMIC_RELAXED);
+    }
+
+  S->retired = old;
+  __atomic_store_n(&shard->slots, S, __ATOMIC_RELEASE);
+  return S;
+}
+
+
+static const char *
+_arena_copy(struct xml_token_shard_t *shard, const char *str, unsigned len)
+{
+  struct xml_token_arena_t *a = shard->arena;
+  char *copy;
+
+  if (a == 0 || a->size - a->used < len + 1)
+    {
+      /*i
+Long names get a block of their own, the current block is kept.
+       */
+      unsigned size = (len + 1 > arena_block_size) ?
+	len + 1 : arena_block_size;
+      struct xml_token_arena_t *b = malloc(sizeof(*b) + size);
+      if (b == 0)
+	return 0;
+      b->size = size;
+      b->used = 0;
+      if (a && len + 1 > arena_block_size)
+	{
+	  b->prev = a->prev;
+	  a->prev = b;
+	}
+      else
+	{
+	  b->prev = a;
+	  shard->arena = b;
+	}
+      a = b;
+    }
+
+  copy = a->data + a->used;
+  a->used += len + 1;
+  memcpy(copy, str, len);
+  copy[len] = 0;
+  return copy;
+}
+
+
+/*i
+With a limit the strings are allocated one by one, so the ones of
+reclaimed tokens can be freed.
+ */
+static const char *
+_heap_copy(const char *str, unsigned len)
+{
+  char *copy = malloc(len + 1);
+  if (copy)
+    {
+      memcpy(copy, str, len);
+      copy[len] = 0;
+    }
+  return copy;
+}
+
+
+static xml_token_t
+_insert(struct xml_token_table_t *T, struct xml_token_shard_t *shard,
+	unsigned mixed, const char *str, unsigned len, unsigned hash)
+{
+  struct xml_token_slots_t *S = shard->slots;
+  struct xml_token_name_t *name;
+  struct xml_token_usage_t *usage;
+  bool heap = __atomic_load_n(&T->limit, __ATOMIC_RELAXED) != 0;
+  const char *copy;
+  xml_token_t token;
+  unsigned i;
+
+  /*i
+Another thread may have added the name since the lookup.
+   */
+  if (S && (token = _find_in(T, S, mixed, str, len, hash)) != not_a_token)
+    return token;
+
+  if (S == 0 || 4*(S->used + 1) > 3*(S->mask + 1))
+    if (0 == (S = _grow_slots(T, shard)))
+      return not_a_token;
+
+  /*i
+When all token IDs are taken @code{not_a_token} is returned.
+   */
+  copy = heap ? _heap_copy(str, len) : _arena_copy(shard, str, len);
+  if (copy == 0)
+    return not_a_token;
+  if (not_a_token == (token = _next_id(T)))
+    {
+      if (heap)
+	free((void *)copy);
+      return not_a_token;
+    }
+
+  name = _name(T, token);
+  usage = _usage(T, token);
+  name->len = len;
+  name->hash = hash;
+  __atomic_store_n(&usage->used, __atomic_load_n(&T->generation,
+						 __ATOMIC_RELAXED),
+		   __ATOMIC_RELAXED);
+  usage->pinned = false;
+  usage->heap = heap;
+  __atomic_store_n(&name->str, copy, __ATOMIC_RELEASE);
+
+  for(i = mixed & S->mask; S->slot[i]; i = (i + 1) & S->mask);
+  __atomic_store_n(S->slot + i, (uint64_t)hash << 32 | ((unsigned)token + 1),
+		   __ATOMIC_RELEASE);
+  ++S->used;
+  __atomic_add_fetch(&T->values, 1, __ATOMIC_RELAXED);
+  return token;
+}
+
+
+/*i
+@section Reclaiming
+
+Tokens are reclaimed one by one when a new one would pass the limit.
+The CLOCK hand goes over the IDs and takes the first unpinned token not
+looked up in the current generation.  When a whole turn finds none,
+new tokens are refused until the next generation.
+
+The slot of the token is marked and its string cleared at once, so the
+name is not found any more.  Its ID and string are kept for two more
+generations, for lookups on other threads which may still read them.
+ */
+static bool
+_retire(struct xml_token_table_t *T, xml_token_t token, const char *str,
+	unsigned generation)
+{
+  if (T->retired_size == T->retired_capacity)
+    {
+      unsigned capacity = T->retired_capacity ?
+	2*T->retired_capacity : initial_names;
+      struct xml_token_retired_t *retired =
+	realloc(T->retired, capacity*sizeof(*retired));
+      if (retired == 0)
+	return false;
+      T->retired = retired;
+      T->retired_capacity = capacity;
+    }
+  T->retired[T->retired_size].str = str;
+  T->retired[T->retired_size].token = token;
+  T->retired[T->retired_size].generation = generation;
+  ++T->retired_size;
+  return true;
+}
+
+
+/*i
+A lookup stamps the token before it checks the string, the reclaimer
+clears the string before it checks the stamp, so at most one of them
+goes on.
+ */
+static bool
+_reclaim(struct xml_token_table_t *T, xml_token_t token, const char *str,
+	 unsigned generation)
+{
+  struct xml_token_name_t *name = _name(T, token);
+  unsigned mixed = _mix(name->hash);
+  struct xml_token_shard_t *shard = _shard_of(T, mixed);
+  struct xml_token_slots_t *S;
+  unsigned i;
+
+  pthread_mutex_lock(&shard->lock);
+  __atomic_store_n(&name->str, 0, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&_usage(T, token)->used, __ATOMIC_SEQ_CST) == generation)
+    {
+      __atomic_store_n(&name->str, str, __ATOMIC_RELEASE);
+      pthread_mutex_unlock(&shard->lock);
+      return false;
+    }
+
+  S = shard->slots;
+  for(i = mixed & S->mask;
+      (unsigned)S->slot[i] != (unsigned)token + 1; i = (i + 1) & S->mask);
+  __atomic_store_n(S->slot + i, (uint64_t)1 << 32, __ATOMIC_RELEASE);
+  ++S->dead;
+  pthread_mutex_unlock(&shard->lock);
+
+  __atomic_sub_fetch(&T->values, 1, __ATOMIC_RELAXED);
+  _retire(T, token, str, generation);
+  return true;
+}
+
+
+static bool
+_reclaim_one(struct xml_token_table_t *T)
+{
+  unsigned generation, size, n;
+  bool found = false;
+
+  pthread_mutex_lock(&T->clock_lock);
+  generation = T->generation;
+  size = __atomic_load_n(&T->names_size, __ATOMIC_ACQUIRE);
+
+  if (T->clock_full != generation + 1)
+    {
+      for(n = T->base_size; n < size && !found; ++n)
+	{
+	  xml_token_t token;
+	  struct xml_token_usage_t *usage;
+	  const char *str;
+
+	  if (T->clock_hand < T->base_size || T->clock_hand >= size)
+	    T->clock_hand = T->base_size;
+	  token = T->clock_hand++;
+
+	  /*i
+An ID being reused is seen only once its string is stored.
+	   */
+	  if (0 == (usage = _usage(T, token)) ||
+	      0 == (str = __atomic_load_n(&_name(T, token)->str,
+					  __ATOMIC_ACQUIRE)))
+	    continue;
+	  if (!usage->pinned &&
+	      __atomic_load_n(&usage->used, __ATOMIC_RELAXED) != generation)
+	    found = _reclaim(T, token, str, generation);
+	}
+      if (!found)
+	T->clock_full = generation + 1;
+    }
+
+  pthread_mutex_unlock(&T->clock_lock);
+  return found;
+}
+
+
+/*i
+Caps the count of unpinned tokens.  Zero, the default, means no cap.
+A limit should be set before the table is used: strings of tokens made
+before are kept in the arena and are not freed when reclaimed.
+ */
+void
+set_xml_token_limit(struct xml_token_table_t *T, unsigned limit)
+{
+  __atomic_store_n(&T->limit, limit, __ATOMIC_RELAXED);
+}
+
+
+/*i
+A pinned token is never reclaimed.  Tokens the application keeps across
+generations (including the ``xmlns'' and empty-name tokens a reader
+keeps) must be pinned; snapshot tokens are always kept.
+ */
+void
+pin_xml_token(struct xml_token_table_t *T, xml_token_t token)
+{
+  struct xml_token_usage_t *usage;
+
+  if (token < T->base_size ||
+      token >= __atomic_load_n(&T->names_size, __ATOMIC_ACQUIRE))
+    return;
+
+  pthread_mutex_lock(&T->clock_lock);
+  usage = _usage(T, token);
+  if (usage && !usage->pinned &&
+      __atomic_load_n(&_name(T, token)->str, __ATOMIC_ACQUIRE))
+    {
+      __atomic_store_n(&usage->pinned, true, __ATOMIC_RELEASE);
+      __atomic_sub_fetch(&T->values, 1, __ATOMIC_RELAXED);
+    }
+  pthread_mutex_unlock(&T->clock_lock);
+}
+
+
+/*i
+Starts the next generation and returns its number.  It should be called
+at points where the application keeps no unpinned tokens, for example
+after each document: an unpinned token stays valid only within the
+generation it was looked up in.  Tokens reclaimed two generations ago
+give their IDs for reuse and their strings are freed, as are slot
+arrays replaced as long ago.
+ */
+unsigned
+next_xml_token_generation(struct xml_token_table_t *T)
+{
+  unsigned generation, i, keep = 0;
+
+  pthread_mutex_lock(&T->clock_lock);
+  generation = T->generation + 1;
+  __atomic_store_n(&T->generation, generation, __ATOMIC_SEQ_CST);
+
+  for(i = 0; i < T->retired_size; ++i)
+    {
+      struct xml_token_retired_t r = T->retired[i];
+
+      if (generation - r.generation < 2)
+	{
+	  T->retired[keep++] = r;
+	  continue;
+	}
+
+      if (_usage(T, r.token)->heap)
+	free((void *)r.str);
+
+      pthread_mutex_lock(&T->free_lock);
+      if (T->free_size == T->free_capacity)
+	{
+	  unsigned capacity = T->free_capacity ?
+	    2*T->free_capacity : initial_names;
+	  xml_token_t *ids = realloc(T->free, capacity*sizeof(*ids));
+	  if (ids)
+	    {
+	      T->free = ids;
+	      T->free_capacity = capacity;
+	    }
+	}
+      if (T->free_size != T->free_capacity)
+	{
+	  T->free[T->free_size] = r.token;
+	  __atomic_store_n(&T->free_size, T->free_size + 1, __ATOMIC_RELAXED);
+	}
+      pthread_mutex_unlock(&T->free_lock);
+    }
+  T->retired_size = keep;
+  pthread_mutex_unlock(&T->clock_lock);
+
+  for(i = 0; i < xml_token_shards; ++i)
+    {
+      struct xml_token_shard_t *shard = T->shards + i;
+      struct xml_token_slots_t *S, **prev;
+
+      pthread_mutex_lock(&shard->lock);
+      for(prev = shard->slots ? &shard->slots->retired : 0;
+	  prev && (S = *prev); )
+	{
+	  if (generation - S->generation >= 2)
+	    {
+	      *prev = S->retired;
+	      free(S);
+	    }
+	  else
+	    prev = &S->retired;
+	}
+      pthread_mutex_unlock(&shard->lock);
+    }
+
+  return generation;
+}
+
+
+xml_token_t
+intern_xml_token(struct xml_token_table_t *T,
+		 const char *str, unsigned len, unsigned hash)
+{
+  unsigned mixed = _mix(hash);
+  struct xml_token_shard_t *shard = _shard_of(T, mixed);
+  struct xml_token_slots_t *S;
+  xml_token_t token;
+
+  if (T->base_slots &&
+      (token = _find_in_base(T, mixed, str, len, hash)) != not_a_token)
+    return token;
+
+  S = __atomic_load_n(&shard->slots, __ATOMIC_ACQUIRE);
+  if (S && (token = _find_in(T, S, mixed, str, len, hash)) != not_a_token)
+    return token;
+
+  if (__atomic_load_n(&T->limit, __ATOMIC_RELAXED) &&
+      __atomic_load_n(&T->values, __ATOMIC_RELAXED) >= T->limit &&
+      !_reclaim_one(T))
+    return not_a_token;
+
+  pthread_mutex_lock(&shard->lock);
+  token = _insert(T, shard, mixed, str, len, hash);
+  pthread_mutex_unlock(&shard->lock);
+  return token;
+}
+
+
+/*i
+Interns a name and pins its token.  Readers keep the tokens of open
+tags and namespace bindings across nodes (see
+@code{set_read_xml_name_tokens}), so with a limit they must not be
+reclaimed while the document is parsed.  Without a limit it is the same
+as @code{intern_xml_token}.  A token reclaimed between the lookup and
+the pinning is looked up again.
+ */
+xml_token_t
+intern_xml_name(struct xml_token_table_t *T,
+		const char *str, unsigned len, unsigned hash)
+{
+  xml_token_t token;
+
+  do
+    {
+      token = intern_xml_token(T, str, len, hash);
+      if (token == not_a_token || token < T->base_size ||
+	  __atomic_load_n(&T->limit, __ATOMIC_RELAXED) == 0)
+	return token;
+      if (!__atomic_load_n(&_usage(T, token)->pinned, __ATOMIC_ACQUIRE))
+	pin_xml_token(T, token);
+    }
+  while (!__atomic_load_n(&_usage(T, token)->pinned, __ATOMIC_ACQUIRE));
+  return token;
+}
+
+
+void
+xml_token_table_stats(struct xml_token_table_t *T,
+		      struct xml_token_stats_t *S)
+{
+  unsigned long long total = 0;
+  unsigned i, j, found = 0;
+
+  S->slots = 0;
+  S->tokens = __atomic_load_n(&T->names_size, __ATOMIC_RELAXED);
+  S->values = __atomic_load_n(&T->values, __ATOMIC_RELAXED);
+  S->generation = __atomic_load_n(&T->generation, __ATOMIC_RELAXED);
+  S->worst_probes = 0;
+
+  if (T->base_slots)
+    {
+      S->slots += T->base_mask + 1;
+      for(j = 0; j <= T->base_mask; ++j)
+	if (T->base_slots[j])
+	  {
+	    unsigned probes =
+	      ((j - _mix(T->base_slots[j] >> 32)) & T->base_mask) + 1;
+	    total += probes;
+	    ++found;
+	    if (S->worst_probes < probes)
+	      S->worst_probes = probes;
+	  }
+    }
+
+  for(i = 0; i < xml_token_shards; ++i)
+    {
+      struct xml_token_shard_t *shard = T->shards + i;
+      struct xml_token_slots_t *slots;
+
+      pthread_mutex_lock(&shard->lock);
+      if ((slots = shard->slots))
+	{
+	  S->slots += slots->mask + 1;
+	  for(j = 0; j <= slots->mask; ++j)
+	    if ((unsigned)slots->slot[j])
+	      {
+		unsigned probes =
+		  ((j - _mix(slots->slot[j] >> 32)) & slots->mask) + 1;
+		total += probes;
+		++found;
+		if (S->worst_probes < probes)
+		  S->worst_probes = probes;
+	      }
+	}
+      pthread_mutex_unlock(&shard->lock);
+    }
+
+  S->avg_probes_x100 = found ? 100*total/found : 0;
+}
+
+
+/*i
+@section Snapshots
+
+The snapshot gets all tokens of the table, a table started from a
+snapshot may thus be saved again with the new tokens added.  The slots
+are at most half full, so lookups in it rarely probe twice.
+ */
+static bool
+_write_all(int io, const void *data, size_t size)
+{
+  const char *p = data;
+  while (size)
+    {
+      ssize_t n = write(io, p, size);
+      if (n <= 0)
+	return false;
+      p += n;
+      size -= n;
+    }
+  return true;
+}
+
+
+bool
+save_xml_token_table(struct xml_token_table_t *T, int io)
+{
+  struct xml_token_snapshot_t H;
+  struct xml_token_snapshot_name_t *names;
+  struct xml_token_name_t name;
+  const char **strings;
+  uint64_t *slots;
+  unsigned size = __atomic_load_n(&T->names_size, __ATOMIC_ACQUIRE);
+  unsigned slots_size = initial_slots, i, j;
+  uint64_t strings_size = 0;
+  bool ok;
+
+  while (slots_size < 2*(uint64_t)size)
+    slots_size *= 2;
+
+  memset(&H, 0, sizeof(H));
+  memcpy(H.magic, snapshot_magic, sizeof(H.magic));
+  H.byte_order = 0x01020304;
+  H.hash_algorithm = XML_HASH;
+  H.token_bits = 8*sizeof(xml_token_t);
+  H.tokens = size;
+  H.slots_mask = slots_size - 1;
+
+  slots = calloc(slots_size, sizeof(*slots));
+  names = malloc(size*sizeof(*names) + 1);
+  strings = malloc(size*sizeof(*strings) + 1);
+  if (slots == 0 || names == 0 || strings == 0)
+    {
+      free(slots);
+      free(names);
+      free(strings);
+      return false;
+    }
+
+  for(i = 0; i < size; ++i)
+    {
+      /*i
+A name still being added by another thread, or a reclaimed one, is
+saved empty and cannot be found.
+       */
+      bool found = xml_token_table_name(T, i, &name);
+      if (!found)
+	{
+	  name.str = "";
+	  name.len = 0;
+	  name.hash = 0;
+	}
+      strings[i] = name.str;
+      names[i].offset = strings_size;
+      names[i].len = name.len;
+      names[i].hash = name.hash;
+      strings_size += name.len + 1;
+
+      if (found)
+	{
+	  for(j = _mix(name.hash) & H.slots_mask;
+	      slots[j]; j = (j + 1) & H.slots_mask);
+	  slots[j] = (uint64_t)name.hash << 32 | (i + 1);
+	}
+    }
+  H.strings_size = strings_size;
+
+  ok = strings_size == H.strings_size &&
+    _write_all(io, &H, sizeof(H)) &&
+    _write_all(io, slots, slots_size*sizeof(*slots)) &&
+    _write_all(io, names, size*sizeof(*names));
+
+  for(i = 0; ok && i < size; ++i)
+    ok = _write_all(io, strings[i], names[i].len + 1);
+
+  free(slots);
+  free(names);
+  free(strings);
+  return ok;
+}
+
+
+/*i
+Starts an empty table from a snapshot.  The snapshot is mapped, it is
+not read in: pages are shared with other processes mapping the same
+file and only the touched ones are loaded.  Returns false and leaves
+the table empty when the file is not a snapshot of this build.  The
+layout is checked, the names themselves are trusted.
+ */
+bool
+load_xml_token_table(struct xml_token_table_t *T, int io)
+{
+  struct stat st;
+  const struct xml_token_snapshot_t *H;
+  const char *addr;
+  uint64_t need;
+
+  if (T->names_size != 0 || T->base_map != 0)
+    return false;
+
+  if (fstat(io, &st) != 0 || !S_ISREG(st.st_mode) ||
+      (unsigned long long)st.st_size < sizeof(*H) ||
+      (unsigned long long)st.st_size != (size_t)st.st_size)
+    return false;
+
+  addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, io, 0);
+  if (addr == MAP_FAILED)
+    return false;
+
+  H = (const struct xml_token_snapshot_t *)addr;
+  need = sizeof(*H) +
+    ((uint64_t)H->slots_mask + 1)*sizeof(uint64_t) +
+    (uint64_t)H->tokens*sizeof(struct xml_token_snapshot_name_t) +
+    H->strings_size;
+
+  if (0 != memcmp(H->magic, snapshot_magic, sizeof(H->magic)) ||
+      H->byte_order != 0x01020304 ||
+      H->hash_algorithm != XML_HASH ||
+      H->token_bits != 8*sizeof(xml_token_t) ||
+      H->tokens >= not_a_token ||
+      (H->slots_mask & (H->slots_mask + 1)) != 0 ||
+      H->tokens > H->slots_mask ||
+      need != (unsigned long long)st.st_size ||
+      (H->strings_size && addr[st.st_size - 1] != 0))
+    {
+      munmap((void *)addr, st.st_size);
+      return false;
+    }
+
+  T->base_map = addr;
+  T->base_map_size = st.st_size;
+  T->base_slots = (const uint64_t *)(H + 1);
+  T->base_mask = H->slots_mask;
+  T->base_size = H->tokens;
+  T->base_names = (const struct xml_token_snapshot_name_t *)
+    (T->base_slots + T->base_mask + 1);
+  T->base_strings = (const char *)(T->base_names + T->base_size);
+  T->names_size = T->base_size;
+  return true;
+}
@@ -0,0 +1,251 @@
+#ifndef READ_XML_TOKENS_H
+#define READ_XML_TOKENS_H
+
+#include "read_xml.h"
+#include <stdint.h>
+#include <pthread.h>
+
+/*i
+@chapter Token table
+
+A reusable implementation of the token table which
+@code{xml_token_by_name} and @code{xml_token_name} are built on.
+Names are kept in an open addressing hash table with stored hashes,
+which grows automatically.  The strings are copied into a bump arena,
+so they are dense in memory and need no allocation of their own.
+Token IDs are dense: they are given in order of first appearance
+starting from 0.
+
+The table may be shared by readers on several threads.  Lookups of
+existing tokens take no lock and never wait.  The hash table is split
+into shards by name hash, each with a mutex taken only to insert a new
+name.  Token names never move once added, so the strings returned by
+@code{xml_token_table_name} stay valid until
+@code{done_xml_token_table}.
+
+A table can be saved to a snapshot file and started from one.  The
+snapshot is mapped read-only and shared by all processes using it;
+tokens it does not know are added to a private overlay with IDs
+following the snapshot ones.
+
+For long running processes the count of unpinned tokens may be capped,
+see @code{set_xml_token_limit}: tokens are then reclaimed in CLOCK
+order and their IDs and strings are reused, so the table stops growing
+however many distinct values it has seen.  An unpinned token, and its
+name, are then valid only within the generation it was looked up in,
+see @code{next_xml_token_generation}.  Names interned by
+@code{intern_xml_name} are pinned, so the cap applies to values.
+ */
+
+enum
+  {
+    xml_token_shards = 16,
+    xml_token_segments = 25,
+  };
+
+
+/*i
+Name of a token.  The string is null-terminated.
+ */
+struct xml_token_name_t
+{
+  const char *str;
+  unsigned len;
+  unsigned hash;
+};
+
+
+/*i
+Reclaiming state of a token: the generation of its last lookup, and
+whether its string is allocated apart from the arena.  It is kept apart
+from the names, so lookups without a limit do not load it.
+ */
+struct xml_token_usage_t
+{
+  unsigned used;
+  bool pinned;
+  bool heap;
+};
+
+
+/*i
+A block of the string arena.
+ */
+struct xml_token_arena_t
+{
+  struct xml_token_arena_t *prev;
+  unsigned size;
+  unsigned used;
+  char data[];
+};
+
+
+/*i
+Slot array of a shard.  Each slot keeps the name hash in the high half
+and token ID plus one in the low half, zero is an empty slot and a zero
+low half alone marks a reclaimed token.  When the array is replaced the
+old array is kept in @code{retired}, since lookups on other threads may
+still walk it: until the table is freed, or two generations after
+@code{generation}, the one it was replaced in.
+ */
+struct xml_token_slots_t
+{
+  struct xml_token_slots_t *retired;
+  unsigned generation;
+  unsigned mask;
+  unsigned used;
+  unsigned dead;
+  uint64_t slot[];
+};
+
+
+/*i
+A reclaimed token: its ID is reused and its string freed two
+generations later.
+ */
+struct xml_token_retired_t
+{
+  const char *str;
+  xml_token_t token;
+  unsigned generation;
+};
+
+
+struct xml_token_shard_t
+{
+  pthread_mutex_t lock;
+  struct xml_token_slots_t *slots;
+  struct xml_token_arena_t *arena;
+} __attribute__((aligned(64)));
+
+
+/*i
+@section Snapshot format
+
+A header, then @code{slots_mask + 1} slots as in a shard, one
+@code{xml_token_snapshot_name_t} per token and the null-terminated
+names, all in the byte order of the host.  The hash algorithm and the
+token width are recorded, a snapshot made with other ones is refused.
+ */
+struct xml_token_snapshot_t
+{
+  char magic[8];
+  uint32_t byte_order;
+  uint32_t hash_algorithm;
+  uint32_t token_bits;
+  uint32_t tokens;
+  uint32_t slots_mask;
+  uint32_t strings_size;
+};
+
+struct xml_token_snapshot_name_t
+{
+  uint32_t offset;
+  uint32_t len;
+  uint32_t hash;
+};
+
+
+struct xml_token_table_t
+{
+  struct xml_token_shard_t shards[xml_token_shards];
+
+  /*i
+Names by token ID.  Segment @var{k} holds 256 << @var{k} names, so
+the directory grows without moving them, followed by as many
+@code{xml_token_usage_t}.
+   */
+  struct xml_token_name_t *segments[xml_token_segments];
+  unsigned names_size;
+
+  /*i
+Reclaiming: the cap of unpinned tokens (zero for none) and their
+count, the current generation and the CLOCK hand.  @code{clock_lock}
+guards the hand and the retired tokens, @code{free_lock} the IDs ready
+for reuse.
+   */
+  unsigned limit;
+  unsigned values;
+  unsigned generation;
+  unsigned clock_hand;
+  unsigned clock_full;
+  pthread_mutex_t clock_lock;
+  struct xml_token_retired_t *retired;
+  unsigned retired_size;
+  unsigned retired_capacity;
+  pthread_mutex_t free_lock;
+  xml_token_t *free;
+  unsigned free_size;
+  unsigned free_capacity;
+
+  /*i
+The mapped snapshot, if any; its tokens are 0 to @code{base_size - 1}.
+   */
+  const void *base_map;
+  size_t base_map_size;
+  const uint64_t *base_slots;
+  unsigned base_mask;
+  unsigned base_size;
+  const struct xml_token_snapshot_name_t *base_names;
+  const char *base_strings;
+};
+
+
+/*i
+Usage statistics of the hash table: the number of slots, of token IDs
+and of live unpinned tokens, the generation, and the average (times
+100) and the worst count of probes to find an existing token.
+ */
+struct xml_token_stats_t
+{
+  unsigned slots;
+  unsigned tokens;
+  unsigned values;
+  unsigned generation;
+  unsigned avg_probes_x100;
+  unsigned worst_probes;
+};
+
+
+void
+init_xml_token_table(struct xml_token_table_t *T);
+
+void
+done_xml_token_table(struct xml_token_table_t *T);
+
+xml_token_t
+intern_xml_token(struct xml_token_table_t *T,
+		 const char *str, unsigned len, unsigned hash);
+
+xml_token_t
+intern_xml_name(struct xml_token_table_t *T,
+		const char *str, unsigned len, unsigned hash);
+
+xml_token_t
+find_xml_token(struct xml_token_table_t *T,
+	       const char *str, unsigned len, unsigned hash);
+
+bool
+xml_token_table_name(struct xml_token_table_t *T, xml_token_t token,
+		     struct xml_token_name_t *name);
+
+bool
+save_xml_token_table(struct xml_token_table_t *T, int io);
+
+bool
+load_xml_token_table(struct xml_token_table_t *T, int io);
+
+void
+set_xml_token_limit(struct xml_token_table_t *T, unsigned limit);
+
+void
+pin_xml_token(struct xml_token_table_t *T, xml_token_t token);
+
+unsigned
+next_xml_token_generation(struct xml_token_table_t *T);
+
+void
+xml_token_table_stats(struct xml_token_table_t *T,
+		      struct xml_token_stats_t *S);
+
+#endif /* READ_XML_TOKENS_H */
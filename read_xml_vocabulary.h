@@ -0,0 +1,275 @@
+#ifndef READ_XML_VOCABULARY_H
+#define READ_XML_VOCABULARY_H
+
+extern "C" {
+#include "read_xml.h"
+}
+#include <stdint.h>
+#include <string.h>
+
+/*i
+@chapter Known vocabulary
+
+A C++ (C++14 or later) helper for names known at compile time, such as
+the tags and attributes of a fixed schema.  A vocabulary is built from
+a list of names by the compiler: the token of a name is its index in
+the list, so tokens are constants usable in @code{case} labels, and a
+perfect hash over the reader hashes of the names recognizes them with
+one probe and one comparison.
+
+@example
+constexpr const char *names[] = @{"item", "type", "value"@};
+constexpr auto vocabulary = make_xml_vocabulary(names);
+enum @{ t_type = vocabulary["type"] @};
+
+xml_token_t
+known_token(const char *str, unsigned len, unsigned hash)
+@{
+  return vocabulary.find(str, len, hash);
+@}
+@end example
+
+The recognizer is given to the reader by
+@code{set_read_xml_known_tokens}.  @code{xml_token_by_name} should
+give the same tokens for these names, usually by interning the list in
+order before anything else.  Equal names, or names with equal hashes,
+make the vocabulary fail to compile.
+ */
+
+/*i
+The reader hash of @code{XML_HASH}, usable at compile time.
+ */
+constexpr unsigned
+xml_const_hash(const char *str, unsigned len)
+{
+#if XML_HASH == XML_HASH_FNV1A
+  unsigned hash = 2166136261u;
+  for(unsigned i = 0; i < len; ++i)
+    hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+  return hash;
+#elif XML_HASH == XML_HASH_WORD
+  static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+		"the word hash is computed by loads of the host order");
+  uint64_t hash = len * 0x9e3779b97f4a7c15ull;
+  uint64_t w = 0;
+  unsigned p = 0;
+  for(; len >= 8; p += 8, len -= 8)
+    {
+      w = 0;
+      for(unsigned i = 8; i; --i)
+	w = w << 8 | (unsigned char)str[p + i - 1];
+      hash = (hash ^ w) * 0xff51afd7ed558ccdull;
+      hash ^= hash >> 32;
+    }
+  if (len >= 4)
+    {
+      uint32_t a = 0, b = 0;
+      for(unsigned i = 4; i; --i)
+	{
+	  a = a << 8 | (unsigned char)str[p + i - 1];
+	  b = b << 8 | (unsigned char)str[p + len - 4 + i - 1];
+	}
+      w = (uint64_t)a << 32 | b;
+    }
+  else if (len)
+    w = (uint64_t)(unsigned char)str[p] << 16 |
+      (uint64_t)(unsigned char)str[p + (len >> 1)] << 8 |
+      (unsigned char)str[p + len - 1];
+  else
+    w = 0;
+  hash = (hash ^ w) * 0xc4ceb9fe1a85ec53ull;
+  hash ^= hash >> 29;
+  return (unsigned)(hash ^ (hash >> 32));
+#else
+  unsigned hash = 0;
+  for(unsigned i = 0; i < len; ++i)
+    hash = 33*hash + (unsigned char)str[i];
+  return hash;
+#endif
+}
+
+
+constexpr unsigned
+xml_const_strlen(const char *str)
+{
+  unsigned len = 0;
+  while (str[len])
+    ++len;
+  return len;
+}
+
+
+constexpr unsigned
+xml_const_pow2(unsigned n)
+{
+  unsigned p = 1;
+  while (p < n)
+    p *= 2;
+  return p;
+}
+
+
+template<unsigned N>
+class xml_vocabulary_t
+{
+public:
+  static_assert(N > 0 && N < not_a_token, "bad vocabulary size");
+
+  /*i
+Slots are at most half full, a bucket takes about two names.
+   */
+  static constexpr unsigned slots = xml_const_pow2(2*N);
+  static constexpr unsigned buckets = xml_const_pow2((N + 1)/2);
+
+  constexpr explicit
+  xml_vocabulary_t(const char *const (&names)[N])
+    : names_(), lens_(), hashes_(), disp_(), slot_()
+  {
+    for(unsigned i = 0; i < N; ++i)
+      {
+	names_[i] = names[i];
+	lens_[i] = xml_const_strlen(names[i]);
+	hashes_[i] = xml_const_hash(names[i], lens_[i]);
+      }
+    for(unsigned i = 0; i < slots; ++i)
+      slot_[i] = not_a_token;
+
+    /*i
+Names are sorted by bucket, then buckets are placed largest first, each
+by the first displacement which puts all its names into free slots.
+     */
+    unsigned first[buckets + 1] = {};
+    unsigned order[N] = {};
+    unsigned largest = 0;
+    for(unsigned i = 0; i < N; ++i)
+      ++first[_bucket(hashes_[i]) + 1];
+    for(unsigned b = 0; b < buckets; ++b)
+      {
+	if (largest < first[b + 1])
+	  largest = first[b + 1];
+	first[b + 1] += first[b];
+      }
+    unsigned next[buckets] = {};
+    for(unsigned i = 0; i < N; ++i)
+      {
+	unsigned b = _bucket(hashes_[i]);
+	order[first[b] + next[b]++] = i;
+      }
+
+    for(unsigned size = largest; size; --size)
+      for(unsigned b = 0; b < buckets; ++b)
+	if (first[b + 1] - first[b] == size)
+	  _place(b, order + first[b], size);
+  }
+
+  constexpr unsigned
+  size() const
+  {
+    return N;
+  }
+
+  constexpr const char *
+  name(xml_token_t token) const
+  {
+    return token < N ? names_[token] : 0;
+  }
+
+  /*i
+Token of a name at compile time, @code{not_a_token} if it is not in
+the vocabulary.
+   */
+  constexpr xml_token_t
+  operator[](const char *str) const
+  {
+    for(unsigned i = 0; i < N; ++i)
+      {
+	unsigned j = 0;
+	while (str[j] && str[j] == names_[i][j])
+	  ++j;
+	if (str[j] == names_[i][j])
+	  return (xml_token_t)i;
+      }
+    return not_a_token;
+  }
+
+  /*i
+Token of a name read by the reader, @code{not_a_token} if it is not in
+the vocabulary.
+   */
+  xml_token_t
+  find(const char *str, unsigned len, unsigned hash) const
+  {
+    xml_token_t token = slot_[_slot(hash, disp_[_bucket(hash)])];
+    return (token != not_a_token && hashes_[token] == hash &&
+	    lens_[token] == len && 0 == memcmp(names_[token], str, len)) ?
+      token : (xml_token_t)not_a_token;
+  }
+
+private:
+  static constexpr unsigned
+  _mix(unsigned hash)
+  {
+    hash ^= hash >> 16;
+    hash *= 0x45d9f3bu;
+    hash ^= hash >> 16;
+    return hash;
+  }
+
+  static constexpr unsigned
+  _slot(unsigned hash, unsigned disp)
+  {
+    return _mix(hash ^ (disp*0x9e3779b9u)) & (slots - 1);
+  }
+
+  static constexpr unsigned
+  _bucket(unsigned hash)
+  {
+    return _mix(hash) & (buckets - 1);
+  }
+
+  constexpr void
+  _place(unsigned b, const unsigned *names, unsigned size)
+  {
+    for(unsigned i = 0; i < size; ++i)
+      for(unsigned j = 0; j < i; ++j)
+	if (hashes_[names[i]] == hashes_[names[j]])
+	  throw "equal names or name hashes in the vocabulary";
+
+    for(unsigned disp = 0;; ++disp)
+      {
+	unsigned i = 0;
+	for(; i < size; ++i)
+	  {
+	    unsigned s = _slot(hashes_[names[i]], disp);
+	    if (slot_[s] != not_a_token)
+	      break;
+	    slot_[s] = (xml_token_t)names[i];
+	  }
+
+	if (i == size)
+	  {
+	    disp_[b] = disp;
+	    return;
+	  }
+
+	while (i--)
+	  slot_[_slot(hashes_[names[i]], disp)] = not_a_token;
+      }
+  }
+
+  const char *names_[N];
+  unsigned lens_[N];
+  unsigned hashes_[N];
+  unsigned disp_[buckets];
+  xml_token_t slot_[slots];
+};
+
+
+template<unsigned N>
+constexpr xml_vocabulary_t<N>
+make_xml_vocabulary(const char *const (&names)[N])
+{
+  return xml_vocabulary_t<N>(names);
+}
+
+#endif /* READ_XML_VOCABULARY_H */